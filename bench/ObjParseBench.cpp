@@ -0,0 +1,102 @@
+// Measures OBJ parsing throughput at increasing thread counts, and checks every parse matches the
+// single-threaded one exactly. Without a file it writes a synthetic mesh (a bumpy grid of quads and
+// triangles with UVs, normals, negative indices and several materials) to build/bench.obj first.
+//
+//   make objbench                                  (synthetic mesh, 1 2 4 ... hardware threads)
+//   make objbench OBJ_BENCH_ARGS="scan.obj 1 8 16"  (a file of your own and thread counts)
+
+#include <ObjLoader.h>
+#include <PCG32.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define GRID 1200
+#define REPEATS 3
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void writeMesh(const char *path) {
+	FILE *out = fopen(path, "w");
+	PCG32 rng(3, 0);
+	fprintf(out, "# synthetic benchmark mesh\n");
+	for(int row = 0; row < GRID; row++) {
+		//each row brings its own vertices, so faces can use negative indices into them
+		fprintf(out, "usemtl Material%d\n", row % 5);
+		for(int column = 0; column <= GRID; column++) {
+			for(int edge = 0; edge < 2; edge++) {
+				fprintf(out, "v %f %f %f\n", (float)column / GRID, (row + edge) / (float)GRID, rng.nextFloat() * 0.01f);
+				fprintf(out, "vt %f %f\n", (float)column / GRID, (float)edge);
+				fprintf(out, "vn 0 0 1\n");
+			}
+		}
+		int corners = 2 * (GRID + 1);
+		for(int column = 0; column < GRID; column++) {
+			int a = -corners + 2 * column;
+			if(column % 2 == 0) fprintf(out, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, a + 2, a + 2, a + 2, a + 3, a + 3, a + 3, a + 1, a + 1, a + 1);
+			else fprintf(out, "f %d//%d %d//%d %d//%d\nf %d/%d %d/%d %d/%d\n", a, a, a + 2, a + 2, a + 3, a + 3, a, a, a + 3, a + 3, a + 1, a + 1);
+		}
+	}
+	fclose(out);
+}
+
+bool sameMesh(const ObjMesh &a, const ObjMesh &b) {
+	if(a.vertices.size() != b.vertices.size() || a.texturePoints.size() != b.texturePoints.size() || a.normals.size() != b.normals.size()
+		|| a.triangles.size() != b.triangles.size() || a.materials.size() != b.materials.size()) return false;
+	for(size_t i = 0; i < a.vertices.size(); i++) if(a.vertices[i] != b.vertices[i]) return false;
+	for(size_t i = 0; i < a.texturePoints.size(); i++) if(a.texturePoints[i].x != b.texturePoints[i].x || a.texturePoints[i].y != b.texturePoints[i].y) return false;
+	for(size_t i = 0; i < a.normals.size(); i++) if(a.normals[i] != b.normals[i]) return false;
+	if(!a.triangles.empty() && memcmp(a.triangles.data(), b.triangles.data(), a.triangles.size() * sizeof(ObjTriangle)) != 0) return false;
+	for(size_t i = 0; i < a.materials.size(); i++) if(a.materials[i].name != b.materials[i].name) return false;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = "build/bench.obj";
+	std::vector<int> threadCounts;
+	int first = 1;
+	if(argc > 1 && atoi(argv[1]) == 0) {
+		path = argv[1];
+		first = 2;
+	} else {
+		printf("writing %s\n", path);
+		writeMesh(path);
+	}
+	for(int i = first; i < argc; i++) threadCounts.push_back(atoi(argv[i]));
+	if(threadCounts.empty()) {
+		int hardware = (int)std::thread::hardware_concurrency();
+		for(int threads = 1; threads < hardware; threads *= 2) threadCounts.push_back(threads);
+		threadCounts.push_back(hardware > 0 ? hardware : 1);
+	}
+
+	ObjMesh serial;
+	if(!loadObjMesh(path, serial, 1)) {
+		printf("could not read %s\n", path);
+		return 1;
+	}
+	FILE *file = fopen(path, "rb");
+	fseek(file, 0, SEEK_END);
+	double megabytes = ftell(file) / 1048576.0;
+	fclose(file);
+	printf("%s: %.1f MB, %zu vertices, %zu triangles\n", path, megabytes, serial.vertices.size(), serial.triangles.size());
+
+	for(size_t t = 0; t < threadCounts.size(); t++) {
+		//best of a few runs, as the first can include faulting the file in
+		double best = INFINITY;
+		bool same = true;
+		for(int r = 0; r < REPEATS; r++) {
+			ObjMesh mesh;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			loadObjMesh(path, mesh, threadCounts[t]);
+			best = std::min(best, secondsSince(start));
+			same = same && sameMesh(mesh, serial);
+		}
+		printf("  %2d threads  %8.1f ms  %8.1f MB/s  %s\n", threadCounts[t], best * 1e3, megabytes / best, same ? "identical" : "DIFFERENT FROM SERIAL");
+	}
+	return 0;
+}
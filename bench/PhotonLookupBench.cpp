@@ -0,0 +1,77 @@
+// Compares the photon lookup structures on build time, fixed-radius query time and memory.
+// Photons are scattered over the faces of a unit cube, like photons landing on the walls of a room,
+// and the gather radius is picked so a query finds about 50 of them.
+//
+//   make bench                           (100k, 1M and 10M photons)
+//   make bench BENCH_ARGS="250000 500000" (any list of photon counts)
+
+#include <KDTree.h>
+#include <PhotonGrid.h>
+#include <PCG32.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#define QUERIES 100000
+#define CAPACITY 500
+#define EXPECTED_HITS 50
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<PhotonRecord> cubePhotons(int amount) {
+	PCG32 rng(1, 0);
+	std::vector<PhotonRecord> photons(amount);
+	for(int i = 0; i < amount; i++) {
+		int face = rng.next() % 6;
+		glm::vec3 loc(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+		loc[face % 3] = (float)(face / 3);
+		photons[i] = PhotonRecord{loc, glm::vec3(1.0f), glm::vec3(0, 0, 1)};
+	}
+	return photons;
+}
+
+void bench(const char *name, const PhotonLookup &lookup, double buildSeconds, const std::vector<glm::vec3> &queries, float radius) {
+	std::vector<PhotonHit> hits(CAPACITY);
+	long long gathered = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(size_t q = 0; q < queries.size(); q++) gathered += lookup.radiusSearch(queries[q], radius, hits.data(), CAPACITY);
+	double querySeconds = secondsSince(start);
+	printf("  %-8s build %8.1f ms   query %8.0f ns   memory %8.1f MB   (%.1f photons/query)\n", name,
+		buildSeconds * 1e3, querySeconds * 1e9 / queries.size(), lookup.memoryUsage() / 1048576.0, (double)gathered / queries.size());
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<int> amounts;
+	for(int i = 1; i < argc; i++) amounts.push_back(atoi(argv[i]));
+	if(amounts.empty()) amounts = {100000, 1000000, 10000000};
+
+	for(size_t a = 0; a < amounts.size(); a++) {
+		int amount = amounts[a];
+		std::vector<PhotonRecord> photons = cubePhotons(amount);
+		float radius = glm::sqrt(EXPECTED_HITS * 6.0f / (M_PI * amount));
+		//query at jittered photon positions so every query lands on a surface
+		PCG32 rng(2, 0);
+		std::vector<glm::vec3> queries(QUERIES);
+		for(int q = 0; q < QUERIES; q++) {
+			glm::vec3 jitter(rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f, rng.nextFloat() - 0.5f);
+			queries[q] = photons[rng.next() % amount].loc + radius * jitter;
+		}
+		printf("%d photons, radius %.4f\n", amount, radius);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::unique_ptr<KDTree> tree(new KDTree(photons));
+		double treeSeconds = secondsSince(start);
+		bench("kd-tree", *tree, treeSeconds, queries, radius);
+		tree.reset();
+
+		start = std::chrono::steady_clock::now();
+		std::unique_ptr<PhotonGrid> grid(new PhotonGrid(photons, radius));
+		double gridSeconds = secondsSince(start);
+		bench("grid", *grid, gridSeconds, queries, radius);
+	}
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "DirtyTiles.h"
+#include <algorithm>
+
+int DirtyTiles::tileAt(int x, int y) const {
+    return (y / size) * columns + x / size;
+}
+
+void DirtyTiles::bounds(int tile, int &x0, int &y0, int &x1, int &y1) const {
+    x0 = (tile % columns) * size;
+    y0 = (tile / columns) * size;
+    x1 = std::min(x0 + size, width);
+    y1 = std::min(y0 + size, height);
+}
+
+bool DirtyTiles::isDirty(int tile) const {
+    return dirty[tile] != 0;
+}
+
+bool DirtyTiles::any() const {
+    return count() > 0;
+}
+
+int DirtyTiles::count() const {
+    return (int)std::count(dirty.begin(), dirty.end(), 1);
+}
+
+std::vector<int> DirtyTiles::nearestFirst(float x, float y) const {
+    std::vector<std::pair<float, int>> distances;
+    for(size_t t = 0; t < dirty.size(); t++) {
+        if(!dirty[t]) continue;
+        float dx = (t % columns + 0.5f) * size - x;
+        float dy = (t / columns + 0.5f) * size - y;
+        distances.push_back(std::make_pair(dx * dx + dy * dy, (int)t));
+    }
+    std::sort(distances.begin(), distances.end());
+    std::vector<int> order(distances.size());
+    for(size_t i = 0; i < distances.size(); i++) order[i] = distances[i].second;
+    return order;
+}
+
+void DirtyTiles::markAll() {
+    std::fill(dirty.begin(), dirty.end(), 1);
+    std::fill(passes.begin(), passes.end(), 0);
+}
+
+void DirtyTiles::markTriangles(const std::vector<int> &changed) {
+    for(size_t t = 0; t < triangles.size(); t++) {
+        if(dirty[t] && passes[t] == 0) continue;
+        //both lists are sorted
+        std::vector<int>::const_iterator a = triangles[t].begin(), b = changed.begin();
+        while(a != triangles[t].end() && b != changed.end()) {
+            if(*a == *b) {
+                mark((int)t);
+                break;
+            }
+            if(*a < *b) a++;
+            else b++;
+        }
+    }
+}
+
+void DirtyTiles::markLit() {
+    for(size_t t = 0; t < dirty.size(); t++) if(lit[t]) mark((int)t);
+}
+
+void DirtyTiles::beginRedraw() {
+    for(size_t t = 0; t < dirty.size(); t++) if(dirty[t]) beginTile((int)t);
+    redrawing = true;
+}
+
+bool DirtyTiles::drawable(int x, int y) const {
+    return !redrawing || dirty[tileAt(x, y)];
+}
+
+void DirtyTiles::depend(int tile, int triangle) {
+    //neighbouring pixels mostly see the same triangle, so this catches most repeats before finishRedraw()
+    if(triangles[tile].empty() || triangles[tile].back() != triangle) triangles[tile].push_back(triangle);
+}
+
+void DirtyTiles::dependOnLight(int tile) {
+    lit[tile] = 1;
+}
+
+bool DirtyTiles::dependOnBox(float minX, float minY, float maxX, float maxY, int triangle) {
+    int x0 = 0, y0 = 0, x1 = columns - 1, y1 = rows - 1;
+    if(minX <= maxX && minY <= maxY) {
+        if(maxX < 0 || maxY < 0 || minX >= width || minY >= height) return false;
+        x0 = (int)std::max(0.0f, minX) / size;
+        y0 = (int)std::max(0.0f, minY) / size;
+        x1 = (int)std::min((float)width - 1, maxX) / size;
+        y1 = (int)std::min((float)height - 1, maxY) / size;
+    }
+    bool overlaps = false;
+    for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1; x++) {
+            int tile = y * columns + x;
+            if(!dirty[tile]) continue;
+            depend(tile, triangle);
+            overlaps = true;
+        }
+    }
+    return overlaps;
+}
+
+void DirtyTiles::finishRedraw() {
+    for(size_t t = 0; t < dirty.size(); t++) if(dirty[t]) finishTile((int)t);
+    redrawing = false;
+}
+
+void DirtyTiles::beginTile(int tile) {
+    triangles[tile].clear();
+    lit[tile] = 0;
+}
+
+void DirtyTiles::finishTile(int tile) {
+    sortDependencies(tile);
+    dirty[tile] = 0;
+    passes[tile] = 0;
+}
+
+int DirtyTiles::passesDone(int tile) const {
+    return passes[tile];
+}
+
+void DirtyTiles::finishPass(int tile) {
+    //sorted so markTriangles() can restart a tile partway through
+    sortDependencies(tile);
+    passes[tile]++;
+}
+
+void DirtyTiles::mark(int tile) {
+    dirty[tile] = 1;
+    passes[tile] = 0;
+}
+
+void DirtyTiles::sortDependencies(int tile) {
+    std::sort(triangles[tile].begin(), triangles[tile].end());
+    triangles[tile].erase(std::unique(triangles[tile].begin(), triangles[tile].end()), triangles[tile].end());
+}
+
+DirtyTiles::DirtyTiles() : size(1), columns(0), rows(0), width(0), height(0), redrawing(false) {}
+
+DirtyTiles::DirtyTiles(int width, int height, int size) :
+    size(size), columns((width + size - 1) / size), rows((height + size - 1) / size), width(width), height(height),
+    redrawing(false), dirty(columns * rows, 1), passes(columns * rows, 0), lit(columns * rows, 0), triangles(columns * rows) {}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+//The screen split into size x size tiles, with which tiles need redrawing and what each tile's last drawing
+//depended on: the triangles seen through (or shadowing) its pixels, and whether it was shaded by the light.
+//A redraw goes beginRedraw(), draw only where drawable(), record depend()s, finishRedraw(); or the same a tile
+//at a time with beginTile() and finishTile(), optionally in several passes of finishPass() each.
+class DirtyTiles {
+public:
+    int size;
+    int columns;
+    int rows;
+
+    int tileAt(int x, int y) const;
+    //Pixel bounds [x0, x1) x [y0, y1) of a tile, clipped to the screen
+    void bounds(int tile, int &x0, int &y0, int &x1, int &y1) const;
+    bool isDirty(int tile) const;
+    bool any() const;
+    int count() const;
+    //The dirty tiles, nearest to (x, y) first
+    std::vector<int> nearestFirst(float x, float y) const;
+
+    void markAll();
+    //Dirty every tile whose last drawing depended on one of these (sorted) triangles
+    void markTriangles(const std::vector<int> &triangles);
+    //Dirty every tile the light shaded
+    void markLit();
+
+    //Forget what the dirty tiles depended on and clip drawing to them
+    void beginRedraw();
+    //During a redraw; outside one, everything is drawable
+    bool drawable(int x, int y) const;
+    void depend(int tile, int triangle);
+    void dependOnLight(int tile);
+    //Add a triangle to every dirty tile its screen bounding box overlaps. False if it overlaps none, so it
+    //needn't be drawn. Unusable bounds (NaN from vertices behind the camera) cover the whole screen.
+    bool dependOnBox(float minX, float minY, float maxX, float maxY, int triangle);
+    //Every dirty tile is up to date again
+    void finishRedraw();
+
+    //Or redraw one tile at a time (drawing isn't clipped), leaving the others dirty until they get their turn
+    void beginTile(int tile);
+    void finishTile(int tile);
+    //For a tile redrawn progressively: how many passes over it are done since it was last marked (marking it
+    //again starts it over), and the end of one pass short of the last
+    int passesDone(int tile) const;
+    void finishPass(int tile);
+
+    DirtyTiles();
+    DirtyTiles(int width, int height, int size);
+private:
+    int width;
+    int height;
+    bool redrawing;
+    std::vector<uint8_t> dirty;
+    std::vector<uint8_t> passes;
+    std::vector<uint8_t> lit;
+    std::vector<std::vector<int>> triangles;
+
+    void mark(int tile);
+    void sortDependencies(int tile);
+};
@@ -1,10 +1,12 @@
 #include <array>
 #include "DrawingWindow.h"
+#include "FrameWriter.h"
+#include "ImageEncoder.h"
 // On some platforms you may need to include <cstring> (if you compiler can't find memset !)
 
 DrawingWindow::DrawingWindow() {}
 
-DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) : width(w), height(h), pixelBuffer(w * h) {
+DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) : width(w), height(h), pixelBuffer(w * h), frontBuffer(w * h) {
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0) printMessageAndQuit("Could not initialise SDL: ", SDL_GetError());
 	uint32_t flags = SDL_WINDOW_OPENGL;
 	if (fullscreen) flags |= SDL_WINDOW_FULLSCREEN_DESKTOP;
@@ -25,10 +27,28 @@ DrawingWindow::DrawingWindow(int w, int h, bool fullscreen) : width(w), height(h
 }
 
 void DrawingWindow::renderFrame() {
-	SDL_UpdateTexture(texture, nullptr, pixelBuffer.data(), width * sizeof(uint32_t));
+	swapBuffers();
+	presentFrame(true);
+}
+
+void DrawingWindow::swapBuffers() {
+	// Copied rather than swapped: the next frame may only redraw part of the back buffer
+	std::lock_guard<std::mutex> lock(frontLock);
+	std::copy(pixelBuffer.begin(), pixelBuffer.end(), frontBuffer.begin());
+	frontFresh = true;
+}
+
+bool DrawingWindow::presentFrame(bool force) {
+	{
+		std::lock_guard<std::mutex> lock(frontLock);
+		if (!frontFresh && !force) return false;
+		SDL_UpdateTexture(texture, nullptr, frontBuffer.data(), width * sizeof(uint32_t));
+		frontFresh = false;
+	}
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 	SDL_RenderPresent(renderer);
+	return true;
 }
 
 void DrawingWindow::saveBMP(const std::string &filename) const {
@@ -39,20 +59,18 @@ void DrawingWindow::saveBMP(const std::string &filename) const {
 }
 
 void DrawingWindow::savePPM(const std::string &filename) const {
-	std::ofstream outputStream(filename, std::ofstream::out);
-	outputStream << "P6\n";
-	outputStream << width << " " << height << "\n";
-	outputStream << "255\n";
-
-	for (size_t i = 0; i < width * height; i++) {
-		std::array<char, 3> rgb {{
-				static_cast<char> ((pixelBuffer[i] >> 16) & 0xFF),
-				static_cast<char> ((pixelBuffer[i] >> 8) & 0xFF),
-				static_cast<char> ((pixelBuffer[i] >> 0) & 0xFF)
-		}};
-		outputStream.write(rgb.data(), 3);
-	}
-	outputStream.close();
+	std::vector<uint8_t> buffer;
+	writePPM(filename, pixelBuffer.data(), width, height, buffer);
+}
+
+void DrawingWindow::saveQOI(const std::string &filename) const {
+	std::vector<uint8_t> buffer;
+	writeQOI(filename, pixelBuffer.data(), width, height, buffer);
+}
+
+void DrawingWindow::savePNG(const std::string &filename) const {
+	std::vector<uint8_t> buffer;
+	writePNG(filename, pixelBuffer.data(), width, height, buffer);
 }
 
 bool DrawingWindow::pollForInputEvents(SDL_Event &event) {
@@ -73,6 +91,12 @@ bool DrawingWindow::pollForInputEvents(SDL_Event &event) {
 	return false;
 }
 
+bool DrawingWindow::waitForInputEvents(SDL_Event &event, int timeout) {
+	// Sleep until an event arrives (it stays queued for pollForInputEvents) or timeout milliseconds pass
+	SDL_WaitEventTimeout(nullptr, timeout);
+	return pollForInputEvents(event);
+}
+
 void DrawingWindow::setPixelColour(size_t x, size_t y, uint32_t colour) {
 	if ((x >= width) || (y >= height)) {
 		std::cout << x << "," << y << " not on visible screen area" << std::endl;
@@ -86,6 +110,10 @@ uint32_t DrawingWindow::getPixelColour(size_t x, size_t y) {
 	} else return pixelBuffer[(y * width) + x];
 }
 
+const uint32_t *DrawingWindow::getPixelBuffer() const {
+	return pixelBuffer.data();
+}
+
 void DrawingWindow::clearPixels() {
 	std::fill(pixelBuffer.begin(), pixelBuffer.end(), 0);
 }
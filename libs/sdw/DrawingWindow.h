@@ -3,6 +3,7 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <mutex>
 #include "SDL.h"
 
 class DrawingWindow {
@@ -16,16 +17,28 @@ private:
 	SDL_Renderer *renderer;
 	SDL_Texture *texture;
 	std::vector<uint32_t> pixelBuffer;
+	// The last finished frame, which is what gets presented; guarded by frontLock
+	std::vector<uint32_t> frontBuffer;
+	std::mutex frontLock;
+	bool frontFresh = false;
 
 public:
 	DrawingWindow();
 	DrawingWindow(int w, int h, bool fullscreen);
 	void renderFrame();
+	// Publish the pixels drawn so far as the finished frame (from the drawing thread)
+	void swapBuffers();
+	// Show the last finished frame if it hasn't been shown yet, or regardless if force (from the SDL thread)
+	bool presentFrame(bool force);
 	void savePPM(const std::string &filename) const;
 	void saveBMP(const std::string &filename) const;
+	void saveQOI(const std::string &filename) const;
+	void savePNG(const std::string &filename) const;
 	bool pollForInputEvents(SDL_Event &event);
+	bool waitForInputEvents(SDL_Event &event, int timeout);
 	void setPixelColour(size_t x, size_t y, uint32_t colour);
 	uint32_t getPixelColour(size_t x, size_t y);
+	const uint32_t *getPixelBuffer() const;
 	void clearPixels();
 };
 
@@ -0,0 +1,33 @@
+#include "FrameProfile.h"
+#include <sstream>
+
+FrameTimes FrameProfile::collect() {
+    FrameTimes times;
+    for(int s = 0; s < STAGE_COUNT; s++) times.ms[s] = nanoseconds[s].exchange(0, std::memory_order_relaxed) / 1e6;
+    for(int c = 0; c < COUNTER_COUNT; c++) times.counts[c] = counts[c].exchange(0, std::memory_order_relaxed);
+    return times;
+}
+
+const char *FrameProfile::stageName(ProfileStage stage) {
+    static const char *names[STAGE_COUNT] = {"clear", "transform", "raster", "trace", "gather", "present", "save"};
+    return names[stage];
+}
+
+const char *FrameProfile::counterName(ProfileCounter counter) {
+    static const char *names[COUNTER_COUNT] = {"triangles", "rays", "intersections", "photons"};
+    return names[counter];
+}
+
+FrameProfile::FrameProfile() {
+    for(int s = 0; s < STAGE_COUNT; s++) nanoseconds[s] = 0;
+    for(int c = 0; c < COUNTER_COUNT; c++) counts[c] = 0;
+}
+
+std::string profileJson(int frame, bool complete, const FrameTimes &times) {
+    std::ostringstream json;
+    json << "{\"frame\":" << frame << ",\"complete\":" << (complete ? "true" : "false");
+    for(int s = 0; s < STAGE_COUNT; s++) json << ",\"" << FrameProfile::stageName((ProfileStage)s) << "_ms\":" << times.ms[s];
+    for(int c = 0; c < COUNTER_COUNT; c++) json << ",\"" << FrameProfile::counterName((ProfileCounter)c) << "\":" << times.counts[c];
+    json << "}";
+    return json.str();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//Where a frame's time goes. Stages can nest (tracing includes the photon gathering it does), so they needn't
+//add up to the frame time.
+enum ProfileStage { STAGE_CLEAR, STAGE_TRANSFORM, STAGE_RASTER, STAGE_TRACE, STAGE_GATHER, STAGE_PRESENT, STAGE_SAVE, STAGE_COUNT };
+//How much work it did
+enum ProfileCounter { COUNT_TRIANGLES, COUNT_RAYS, COUNT_INTERSECTIONS, COUNT_PHOTONS, COUNTER_COUNT };
+
+struct FrameTimes {
+    double ms[STAGE_COUNT];
+    uint64_t counts[COUNTER_COUNT];
+};
+
+//Stage times and work counts, added to from any thread and collected once a frame. add() and count() are
+//inline since they're called per pixel.
+class FrameProfile {
+public:
+    void add(ProfileStage stage, std::chrono::steady_clock::duration time) {
+        nanoseconds[stage].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), std::memory_order_relaxed);
+    }
+    void count(ProfileCounter counter, uint64_t n) {
+        counts[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+    //Everything added since the last collect()
+    FrameTimes collect();
+
+    static const char *stageName(ProfileStage stage);
+    static const char *counterName(ProfileCounter counter);
+
+    FrameProfile();
+    FrameProfile(const FrameProfile &) = delete;
+    FrameProfile &operator=(const FrameProfile &) = delete;
+private:
+    std::atomic<int64_t> nanoseconds[STAGE_COUNT];
+    std::atomic<uint64_t> counts[COUNTER_COUNT];
+};
+
+//Adds the time from construction to destruction to a stage
+class ScopedTimer {
+public:
+    ScopedTimer(FrameProfile &profile, ProfileStage stage) : profile(profile), stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { profile.add(stage, std::chrono::steady_clock::now() - start); }
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+private:
+    FrameProfile &profile;
+    ProfileStage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+//One line of JSON for a frame, e.g. {"frame":3,"complete":true,"clear_ms":0.21,...,"triangles":32,...}
+std::string profileJson(int frame, bool complete, const FrameTimes &times);
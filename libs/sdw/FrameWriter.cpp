@@ -0,0 +1,156 @@
+#include "FrameWriter.h"
+#include "TraceEvents.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+void argbToRgb(const uint32_t *argb, uint8_t *rgb, size_t count) {
+    size_t i = 0;
+#if defined(__SSSE3__)
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    //each store writes 16 bytes but only 12 are kept (the next store overwrites the rest), so stop while
+    //a whole store still fits
+    for(; i + 6 <= count; i += 4) {
+        __m128i source = _mm_loadu_si128((const __m128i *)(argb + i));
+        _mm_storeu_si128((__m128i *)(rgb + i * 3), _mm_shuffle_epi8(source, shuffle));
+    }
+#endif
+    for(; i < count; i++) {
+        rgb[i * 3] = (uint8_t)(argb[i] >> 16);
+        rgb[i * 3 + 1] = (uint8_t)(argb[i] >> 8);
+        rgb[i * 3 + 2] = (uint8_t)argb[i];
+    }
+}
+
+bool writeFile(const std::string &path, const uint8_t *data, size_t size) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) return false;
+    //one write() normally covers it; only a short write needs another
+    size_t done = 0;
+    while(done < size) {
+        ssize_t result = write(fd, data + done, size - done);
+        if(result <= 0) break;
+        done += (size_t)result;
+    }
+    close(fd);
+    return done == size;
+}
+
+bool writePPM(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch) {
+    char header[64];
+    int headerLength = std::snprintf(header, sizeof(header), "P6\n%zu %zu\n255\n", width, height);
+    scratch.resize(headerLength + width * height * 3);
+    std::memcpy(scratch.data(), header, headerLength);
+    argbToRgb(pixels, scratch.data() + headerLength, width * height);
+    return writeFile(path, scratch.data(), scratch.size());
+}
+
+size_t PPMSink::write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch) {
+    return writePPM(path, pixels, width, height, scratch) ? scratch.size() : 0;
+}
+
+bool FrameWriter::submit(const uint32_t *pixels, const std::string &path) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(freeSlots.empty()) {
+        if(dropWhenFull) {
+            droppedCount++;
+            return false;
+        }
+        slotFree.wait(lock, [this]() { return !freeSlots.empty(); });
+    }
+    //nobody else touches a slot between taking it off the free list and queueing it
+    size_t index = freeSlots.back();
+    freeSlots.pop_back();
+    lock.unlock();
+    std::memcpy(ring[index].pixels.data(), pixels, width * height * sizeof(uint32_t));
+    ring[index].path = path;
+    lock.lock();
+    pending.push_back(index);
+    frameReady.notify_one();
+    return true;
+}
+
+void FrameWriter::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    slotFree.wait(lock, [this]() { return pending.empty() && busy == 0; });
+}
+
+size_t FrameWriter::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedCount;
+}
+
+FrameStats FrameWriter::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+}
+
+void FrameWriter::setVerbose(bool verbose) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->verbose = verbose;
+}
+
+void FrameWriter::run() {
+    nameTraceThread("frame writer");
+    std::vector<uint8_t> scratch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        frameReady.wait(lock, [this]() { return !pending.empty() || stopping; });
+        if(pending.empty()) return;
+        size_t index = pending.front();
+        pending.pop_front();
+        busy++;
+        lock.unlock();
+        Slot &slot = ring[index];
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes;
+        {
+            TraceScope scope("frame write");
+            bytes = sink->write(slot.pixels.data(), width, height, slot.path, scratch);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(bytes == 0) std::perror(slot.path.c_str());
+        lock.lock();
+        busy--;
+        freeSlots.push_back(index);
+        size_t raw = width * height * 3;
+        totals.frames++;
+        totals.rawBytes += raw;
+        totals.outputBytes += bytes;
+        totals.seconds += seconds;
+        if(verbose && bytes > 0) {
+            char line[256];
+            std::snprintf(line, sizeof(line), "%s: %zu KB (%.2fx) in %.2f ms, %.0f MB/s\n", slot.path.c_str(), bytes / 1024,
+                (double)raw / bytes, seconds * 1000.0, raw / seconds / 1e6);
+            std::cerr << line;
+        }
+        slotFree.notify_all();
+    }
+}
+
+FrameWriter::FrameWriter(size_t width, size_t height, int depth, bool dropWhenFull, std::unique_ptr<FrameSink> sink, int workers) :
+    width(width), height(height), dropWhenFull(dropWhenFull), sink(std::move(sink)), busy(0), stopping(false), verbose(false),
+    droppedCount(0), totals() {
+    ring.resize(depth < 1 ? 1 : depth);
+    for(size_t s = 0; s < ring.size(); s++) {
+        ring[s].pixels.resize(width * height);
+        freeSlots.push_back(ring.size() - 1 - s);
+    }
+    if(workers < 1 || this->sink->ordered()) workers = 1;
+    for(int w = 0; w < workers; w++) this->workers.push_back(std::thread(&FrameWriter::run, this));
+}
+
+FrameWriter::~FrameWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameReady.notify_all();
+    for(size_t w = 0; w < workers.size(); w++) workers[w].join();
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+
+//ARGB to packed RGB, 4 pixels per step where SSSE3 is available
+void argbToRgb(const uint32_t *argb, uint8_t *rgb, size_t count);
+
+//Write size bytes to path with (normally) a single write(). False if the file can't be written.
+bool writeFile(const std::string &path, const uint8_t *data, size_t size);
+
+//Write a binary PPM from a buffer built in scratch
+bool writePPM(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch);
+
+//Where a FrameWriter's frames end up. write() is called from the writer threads, each passing its own scratch
+//buffer, so sinks that don't ask to be ordered() must not keep per-frame state.
+class FrameSink {
+public:
+    //Output one width x height ARGB frame and return the number of bytes produced, or 0 on failure. path is
+    //the name submit() was given for it, which sinks that append to a single stream ignore.
+    virtual size_t write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch) = 0;
+    //Frames have to be written one at a time in submission order (a single stream)
+    virtual bool ordered() const { return false; }
+    virtual ~FrameSink() {}
+};
+
+//One binary PPM file per frame
+class PPMSink : public FrameSink {
+public:
+    size_t write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch);
+};
+
+struct FrameStats {
+    size_t frames;
+    //uncompressed 24-bit size of the frames written, and what the sink actually produced
+    size_t rawBytes;
+    size_t outputBytes;
+    //time spent in FrameSink::write across all workers
+    double seconds;
+};
+
+//Saves frames through a FrameSink on background threads. submit() copies the frame into one of `depth`
+//preallocated slots and returns; `workers` threads take slots oldest first and hand them to the sink (just one
+//for ordered() sinks). When every slot is still waiting to be written, submit() either drops the new frame
+//(dropWhenFull) or waits for a slot to free up.
+class FrameWriter {
+public:
+    //Queue a width x height ARGB frame to be written to path. Returns false if it was dropped.
+    bool submit(const uint32_t *pixels, const std::string &path);
+    //Wait until every queued frame has been written
+    void flush();
+    size_t dropped() const;
+    FrameStats stats() const;
+    //Print each frame's size, compression ratio and throughput to stderr as it's written
+    void setVerbose(bool verbose);
+
+    FrameWriter(size_t width, size_t height, int depth, bool dropWhenFull, std::unique_ptr<FrameSink> sink, int workers = 1);
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+    //Writes out whatever is still queued first
+    ~FrameWriter();
+private:
+    struct Slot {
+        std::vector<uint32_t> pixels;
+        std::string path;
+    };
+    size_t width;
+    size_t height;
+    bool dropWhenFull;
+    std::unique_ptr<FrameSink> sink;
+    std::vector<Slot> ring;
+    std::vector<size_t> freeSlots;
+    //slots waiting for a worker, oldest first
+    std::deque<size_t> pending;
+    //slots a worker is currently writing
+    int busy;
+    bool stopping;
+    bool verbose;
+    size_t droppedCount;
+    FrameStats totals;
+    mutable std::mutex mutex;
+    std::condition_variable frameReady;
+    std::condition_variable slotFree;
+    std::vector<std::thread> workers;
+
+    void run();
+};
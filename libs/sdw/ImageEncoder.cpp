@@ -0,0 +1,295 @@
+#include "ImageEncoder.h"
+#include <cstring>
+
+static inline void putBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+void encodeQOI(const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &out) {
+    size_t count = width * height;
+    //worst case is a 4-byte QOI_OP_RGB per pixel
+    out.resize(14 + count * 4 + 8);
+    uint8_t *o = out.data();
+    std::memcpy(o, "qoif", 4);
+    o[4] = (uint8_t)(width >> 24); o[5] = (uint8_t)(width >> 16); o[6] = (uint8_t)(width >> 8); o[7] = (uint8_t)width;
+    o[8] = (uint8_t)(height >> 24); o[9] = (uint8_t)(height >> 16); o[10] = (uint8_t)(height >> 8); o[11] = (uint8_t)height;
+    o[12] = 3;
+    o[13] = 0;
+    size_t p = 14;
+
+    //with alpha fixed at 255 the index hash is just the colour's, and pixels compare as RGB
+    uint32_t seen[64];
+    for(int i = 0; i < 64; i++) seen[i] = 0xFFFFFFFF;
+    uint32_t previous = 0;
+    int run = 0;
+    for(size_t i = 0; i < count; i++) {
+        uint32_t pixel = pixels[i] & 0xFFFFFF;
+        if(pixel == previous) {
+            run++;
+            if(run == 62 || i + 1 == count) {
+                o[p++] = (uint8_t)(0xC0 | (run - 1));
+                run = 0;
+            }
+            continue;
+        }
+        if(run > 0) {
+            o[p++] = (uint8_t)(0xC0 | (run - 1));
+            run = 0;
+        }
+        int r = (pixel >> 16) & 0xFF, g = (pixel >> 8) & 0xFF, b = pixel & 0xFF;
+        int index = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+        if(seen[index] == pixel) {
+            o[p++] = (uint8_t)index;
+        } else {
+            seen[index] = pixel;
+            //differences wrap around like the decoder's 8-bit arithmetic
+            int8_t dr = (int8_t)(r - (int)((previous >> 16) & 0xFF));
+            int8_t dg = (int8_t)(g - (int)((previous >> 8) & 0xFF));
+            int8_t db = (int8_t)(b - (int)(previous & 0xFF));
+            int8_t drg = (int8_t)(dr - dg), dbg = (int8_t)(db - dg);
+            if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                o[p++] = (uint8_t)(0x40 | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2));
+            } else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                o[p++] = (uint8_t)(0x80 | (dg + 32));
+                o[p++] = (uint8_t)(((drg + 8) << 4) | (dbg + 8));
+            } else {
+                o[p++] = 0xFE;
+                o[p++] = (uint8_t)r;
+                o[p++] = (uint8_t)g;
+                o[p++] = (uint8_t)b;
+            }
+        }
+        previous = pixel;
+    }
+    static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    std::memcpy(o + p, end, 8);
+    out.resize(p + 8);
+}
+
+//Deflate output, least significant bit first
+class BitWriter {
+public:
+    std::vector<uint8_t> &out;
+    uint64_t bits;
+    int count;
+
+    void put(uint32_t value, int length) {
+        bits |= (uint64_t)value << count;
+        count += length;
+        while(count >= 8) {
+            out.push_back((uint8_t)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+    void finish() {
+        if(count > 0) out.push_back((uint8_t)bits);
+        bits = 0;
+        count = 0;
+    }
+
+    BitWriter(std::vector<uint8_t> &out) : out(out), bits(0), count(0) {}
+};
+
+static const uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint32_t reverseBits(uint32_t value, int length) {
+    uint32_t reversed = 0;
+    for(int i = 0; i < length; i++) reversed |= ((value >> i) & 1) << (length - 1 - i);
+    return reversed;
+}
+
+//The fixed Huffman code (RFC 1951 3.2.6), bit-reversed so it can go straight into the BitWriter
+struct FixedHuffman {
+    uint16_t literal[288];
+    uint8_t literalLength[288];
+    uint8_t distance[30];
+    //length 3..258 to its code index
+    uint8_t lengthCode[259];
+    //distance 1..32768 to its code index, by distance - 1 below 256 and (distance - 1) >> 7 above
+    uint8_t distanceSmall[256];
+    uint8_t distanceLarge[256];
+
+    FixedHuffman() {
+        for(int c = 0; c < 288; c++) {
+            uint32_t code;
+            int length;
+            if(c < 144) { code = 0x30 + c; length = 8; }
+            else if(c < 256) { code = 0x190 + (c - 144); length = 9; }
+            else if(c < 280) { code = c - 256; length = 7; }
+            else { code = 0xC0 + (c - 280); length = 8; }
+            literal[c] = (uint16_t)reverseBits(code, length);
+            literalLength[c] = (uint8_t)length;
+        }
+        for(int c = 0; c < 30; c++) distance[c] = (uint8_t)reverseBits(c, 5);
+        for(int c = 0; c < 29; c++) {
+            int end = c == 28 ? 259 : LENGTH_BASE[c + 1];
+            for(int l = LENGTH_BASE[c]; l < end; l++) lengthCode[l] = (uint8_t)c;
+        }
+        for(int c = 0; c < 30; c++) {
+            int end = c == 29 ? 32769 : DISTANCE_BASE[c + 1];
+            for(int d = DISTANCE_BASE[c]; d < end; d++) {
+                if(d <= 256) distanceSmall[d - 1] = (uint8_t)c;
+                else distanceLarge[(d - 1) >> 7] = (uint8_t)c;
+            }
+        }
+    }
+};
+
+static const FixedHuffman &fixedHuffman() {
+    static const FixedHuffman table;
+    return table;
+}
+
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_WINDOW 32768
+
+//zlib stream of data as one final fixed-Huffman block
+static void deflate(const uint8_t *data, size_t size, std::vector<uint8_t> &out) {
+    const FixedHuffman &huffman = fixedHuffman();
+    //literals are at most 9 bits
+    out.reserve(out.size() + size + size / 8 + 64);
+    out.push_back(0x78);
+    out.push_back(0x01);
+    BitWriter writer(out);
+    writer.put(1, 1);
+    writer.put(1, 2);
+
+    //last position each 4-byte prefix was seen at, plus one (0 is empty)
+    std::vector<uint32_t> head(1 << DEFLATE_HASH_BITS, 0);
+    size_t i = 0;
+    while(i < size) {
+        size_t length = 0, distance = 0;
+        if(i + 4 <= size) {
+            uint32_t prefix;
+            std::memcpy(&prefix, data + i, 4);
+            uint32_t hash = (prefix * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+            size_t candidate = head[hash];
+            head[hash] = (uint32_t)(i + 1);
+            if(candidate > 0 && i - (candidate - 1) <= DEFLATE_WINDOW) {
+                const uint8_t *match = data + candidate - 1;
+                size_t limit = size - i < 258 ? size - i : 258;
+                while(length < limit && match[length] == data[i + length]) length++;
+                distance = i - (candidate - 1);
+            }
+        }
+        if(length >= 4) {
+            int code = huffman.lengthCode[length];
+            writer.put(huffman.literal[257 + code], huffman.literalLength[257 + code]);
+            writer.put((uint32_t)(length - LENGTH_BASE[code]), LENGTH_EXTRA[code]);
+            int distanceCode = distance <= 256 ? huffman.distanceSmall[distance - 1] : huffman.distanceLarge[(distance - 1) >> 7];
+            writer.put(huffman.distance[distanceCode], 5);
+            writer.put((uint32_t)(distance - DISTANCE_BASE[distanceCode]), DISTANCE_EXTRA[distanceCode]);
+            //only the start of the match goes in the table, which is what keeps this fast
+            i += length;
+        } else {
+            writer.put(huffman.literal[data[i]], huffman.literalLength[data[i]]);
+            i++;
+        }
+    }
+    writer.put(huffman.literal[256], huffman.literalLength[256]);
+    writer.finish();
+
+    uint32_t a = 1, b = 0;
+    for(size_t start = 0; start < size; start += 5552) {
+        size_t end = start + 5552 < size ? start + 5552 : size;
+        for(size_t k = start; k < end; k++) {
+            a += data[k];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    putBigEndian(out, (b << 16) | a);
+}
+
+struct CrcTable {
+    uint32_t entries[256];
+
+    CrcTable() {
+        for(uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for(int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+    }
+};
+
+static uint32_t crc32(const uint8_t *data, size_t size) {
+    static const CrcTable table;
+    uint32_t c = 0xFFFFFFFFu;
+    for(size_t i = 0; i < size; i++) c = table.entries[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+//Append a chunk whose data is already at out[start + 8...] (after room left for the length and type)
+static void closeChunk(std::vector<uint8_t> &out, size_t start, const char *type) {
+    uint32_t length = (uint32_t)(out.size() - start - 8);
+    out[start] = (uint8_t)(length >> 24);
+    out[start + 1] = (uint8_t)(length >> 16);
+    out[start + 2] = (uint8_t)(length >> 8);
+    out[start + 3] = (uint8_t)length;
+    std::memcpy(&out[start + 4], type, 4);
+    putBigEndian(out, crc32(&out[start + 4], length + 4));
+}
+
+void encodePNG(const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &out) {
+    //filtered scanlines, each a filter byte then RGB
+    size_t stride = 1 + width * 3;
+    std::vector<uint8_t> filtered(stride * height);
+    std::vector<uint8_t> rows(width * 3 * 2);
+    uint8_t *above = rows.data(), *current = rows.data() + width * 3;
+    std::memset(above, 0, width * 3);
+    for(size_t y = 0; y < height; y++) {
+        argbToRgb(pixels + y * width, current, width);
+        uint8_t *line = &filtered[y * stride];
+        line[0] = 2;
+        for(size_t x = 0; x < width * 3; x++) line[1 + x] = (uint8_t)(current[x] - above[x]);
+        std::swap(above, current);
+    }
+
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.assign(signature, signature + 8);
+    size_t start = out.size();
+    out.resize(start + 8);
+    putBigEndian(out, (uint32_t)width);
+    putBigEndian(out, (uint32_t)height);
+    //8-bit truecolour, deflate, adaptive filtering, not interlaced
+    out.push_back(8);
+    out.push_back(2);
+    out.push_back(0);
+    out.push_back(0);
+    out.push_back(0);
+    closeChunk(out, start, "IHDR");
+    start = out.size();
+    out.resize(start + 8);
+    deflate(filtered.data(), filtered.size(), out);
+    closeChunk(out, start, "IDAT");
+    start = out.size();
+    out.resize(start + 8);
+    closeChunk(out, start, "IEND");
+}
+
+bool writeQOI(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch) {
+    encodeQOI(pixels, width, height, scratch);
+    return writeFile(path, scratch.data(), scratch.size());
+}
+
+bool writePNG(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch) {
+    encodePNG(pixels, width, height, scratch);
+    return writeFile(path, scratch.data(), scratch.size());
+}
+
+size_t QOISink::write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch) {
+    return writeQOI(path, pixels, width, height, scratch) ? scratch.size() : 0;
+}
+
+size_t PNGSink::write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch) {
+    return writePNG(path, pixels, width, height, scratch) ? scratch.size() : 0;
+}
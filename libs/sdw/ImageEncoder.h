@@ -0,0 +1,26 @@
+#pragma once
+
+#include "FrameWriter.h"
+
+//Encode an ARGB image (alpha ignored) into out, replacing what was there
+
+//QOI, 3 channels: https://qoiformat.org/qoi-specification.pdf
+void encodeQOI(const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &out);
+//8-bit RGB PNG. Every row uses the Up filter and the image data is one fixed-Huffman deflate block with
+//single-probe LZ77 matching, trading some ratio for speed.
+void encodePNG(const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &out);
+
+bool writeQOI(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch);
+bool writePNG(const std::string &path, const uint32_t *pixels, size_t width, size_t height, std::vector<uint8_t> &scratch);
+
+//One QOI file per frame
+class QOISink : public FrameSink {
+public:
+    size_t write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch);
+};
+
+//One PNG file per frame
+class PNGSink : public FrameSink {
+public:
+    size_t write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch);
+};
@@ -0,0 +1,33 @@
+#include "IrradianceCache.h"
+#include "TraceEvents.h"
+
+//How many of the nearest records to consider before giving up on finding one with a matching normal
+#define CANDIDATES 8
+
+float IrradianceCache::lookup(glm::vec3 loc, glm::vec3 normal, float radius) const {
+    PhotonHit hits[CANDIDATES];
+    int found = tree.radiusSearch(loc, radius, hits, CANDIDATES);
+    float best = 0.0f;
+    float bestDistance2 = INFINITY;
+    for(int i = 0; i < found; i++) {
+        if(glm::abs(glm::dot(tree.direction(hits[i].index), normal)) > 0.9f && hits[i].distance2 < bestDistance2) {
+            best = hits[i].intensity;
+            bestDistance2 = hits[i].distance2;
+        }
+    }
+    return best;
+}
+
+size_t IrradianceCache::size() const {
+    return tree.size();
+}
+
+IrradianceCache::IrradianceCache(const std::vector<IrradianceRecord> &records) {
+    TraceScope scope("irradiance cache build");
+    //the surface normal rides in the packed photon's direction field
+    std::vector<PhotonRecord> points(records.size());
+    for(size_t i = 0; i < records.size(); i++) points[i] = PhotonRecord{records[i].loc, glm::vec3(records[i].irradiance), records[i].normal};
+    tree = KDTree(points);
+}
+
+IrradianceCache::IrradianceCache() = default;
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "KDTree.h"
+
+struct IrradianceRecord {
+    glm::vec3 loc;
+    float irradiance;
+    glm::vec3 normal;
+};
+
+//Irradiance estimates precomputed at a subset of photon sites, so shading a point is one nearest lookup
+//instead of a full photon gather
+class IrradianceCache {
+public:
+    //Irradiance of the nearest record within radius that lies on a surface facing the same way as normal,
+    //or 0 if there is none. Normals are compared ignoring sign, as triangle winding isn't consistent.
+    float lookup(glm::vec3 loc, glm::vec3 normal, float radius) const;
+    size_t size() const;
+
+    IrradianceCache(const std::vector<IrradianceRecord> &records);
+    IrradianceCache();
+private:
+    //records as photons, with the normal stored as the direction
+    KDTree tree;
+};
@@ -1,88 +1,225 @@
 #include "KDTree.h"
+#include "TraceEvents.h"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-Node* KDTree::insert(Node *root, glm::vec4 value, int depth) {
+//On-disk layout: this header followed directly by `count` PackedPhotons
+struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint64_t count;
+    float lower[3];
+    float step;
+    uint32_t nodeSize;
+    uint32_t unused;
+};
+
+static const char SNAPSHOT_MAGIC[4] = {'P', 'M', 'A', 'P'};
+static const uint32_t SNAPSHOT_VERSION = 2;
+
+//Size of the left subtree of a left-balanced tree of n nodes: every level full except the last,
+//which fills from the left
+static int leftSubtreeSize(int n) {
+    int levels = 0;
+    while((2 << levels) - 1 <= n) levels++;
+    int full = (1 << levels) - 1;
+    int last = n - full;
+    return (full - 1) / 2 + std::min(last, 1 << (levels - 1));
+}
+
+void KDTree::build(const std::vector<PackedPhoton> &packed, std::vector<int32_t> &order, int begin, int end, size_t index, int depth) {
+    if(begin >= end) return;
     int axis = depth % 3;
-    if(root == NULL) {
-        // std::cout << "newnode" <<std::endl;
-        Node* n = new Node{glm::vec3(value[0], value[1], value[2]), value[3], NULL, NULL};
-        return n;
-    }
-    if(value[axis] < root->loc[axis]) {
-        // std::cout << "l";
-        root->left = insert(root->left, value, depth + 1);
-    }else {
-        // std::cout << "r";
-        root->right = insert(root->right, value, depth + 1);
-    }
-    return root;
+    int mid = begin + leftSubtreeSize(end - begin);
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+        [&packed, axis](int32_t a, int32_t b) { return packed[a].position[axis] < packed[b].position[axis]; });
+    storage[index] = packed[order[mid]];
+    build(packed, order, begin, mid, 2 * index + 1, depth + 1);
+    build(packed, order, mid + 1, end, 2 * index + 2, depth + 1);
 }
 
-Node* KDTree::nearestSearch(Node *root, glm::vec3 key, int depth, Node* nearest, float minDistance) {
+void KDTree::gather(size_t index, glm::vec3 key, int depth, float &maxDistance2, PhotonHit *heap, int &found, int capacity) const {
+    if(index >= count) return;
+    const PackedPhoton &node = nodes[index];
     int axis = depth % 3;
-    if(root == NULL) {
-        return NULL;
+    glm::vec3 loc = lower + glm::vec3(node.position[0], node.position[1], node.position[2]) * step;
+    glm::vec3 offset = loc - key;
+    float distance2 = glm::dot(offset, offset);
+    //once the heap is full, anything further than the worst kept photon can be skipped
+    if(distance2 < maxDistance2) maxDistance2 = offerHit(heap, found, capacity, PhotonHit{(uint32_t)index, unpackIntensity(node.power), distance2}, maxDistance2);
+    //search the side the key is in first, then the other side only if the splitting plane is close enough
+    float planeDistance = key[axis] - loc[axis];
+    size_t near = planeDistance < 0 ? 2 * index + 1 : 2 * index + 2;
+    size_t far = planeDistance < 0 ? 2 * index + 2 : 2 * index + 1;
+    gather(near, key, depth + 1, maxDistance2, heap, found, capacity);
+    if(planeDistance * planeDistance < maxDistance2) gather(far, key, depth + 1, maxDistance2, heap, found, capacity);
+}
+
+int KDTree::radiusSearch(glm::vec3 loc, float radius, PhotonHit *hits, int capacity) const {
+    int found = 0;
+    float maxDistance2 = radius * radius;
+    if(capacity > 0) gather(0, loc, 0, maxDistance2, hits, found, capacity);
+    return found;
+}
+
+int KDTree::kNearest(glm::vec3 loc, int k, PhotonHit *hits) const {
+    int found = 0;
+    float maxDistance2 = INFINITY;
+    if(k > 0) gather(0, loc, 0, maxDistance2, hits, found, k);
+    return found;
+}
+
+size_t KDTree::size() const {
+    return count;
+}
+
+size_t KDTree::memoryUsage() const {
+    return count * sizeof(PackedPhoton);
+}
+
+glm::vec3 KDTree::position(size_t index) const {
+    const uint16_t *q = nodes[index].position;
+    return lower + glm::vec3(q[0], q[1], q[2]) * step;
+}
+
+glm::vec3 KDTree::power(size_t index) const {
+    return unpackPower(nodes[index].power);
+}
+
+glm::vec3 KDTree::direction(size_t index) const {
+    return unpackDirection(nodes[index].direction);
+}
+
+bool KDTree::save(const std::string &path, uint64_t hash) const {
+    TraceScope scope("kd-tree save");
+    SnapshotHeader header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.hash = hash;
+    header.count = count;
+    for(int a = 0; a < 3; a++) header.lower[a] = lower[a];
+    header.step = step;
+    header.nodeSize = sizeof(PackedPhoton);
+    header.unused = 0;
+    //write to a temporary name first so a crash never leaves a half-written snapshot behind
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath, std::ofstream::out | std::ofstream::binary);
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)nodes, count * sizeof(PackedPhoton));
+    out.close();
+    if(!out) {
+        std::remove(tempPath.c_str());
+        return false;
     }
-    //Add node to list and see if potentiallty nearest
-    // std::cout << minDistance << std::endl;  ////
-    // for(int i = 0; i < traversed.size(); i++) {
-    //     if(glm::distance(root->loc, key) < glm::distance(key, traversed[i]->loc)) {
-    //         traversed.insert(traversed.begin()+i, root); break;
-    //     }
-    // }
-
-    traversed.push_back(root);
-    if(glm::distance(root->loc, key) < minDistance || nearest == NULL) {
-        nearest = root;
-        // std::cout << "1" << std::endl;
-        minDistance = glm::distance(root->loc, key);
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+bool KDTree::load(const std::string &path, uint64_t hash) {
+    release();
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return false;
     }
-    bool left;
-    if(key[axis] < root->loc[axis]) {
-        //go left WITHIN this box
-        left = true;
-        Node *tempNearest = nearestSearch(root->left, key, depth+1, nearest, minDistance);
-        if(tempNearest != NULL) nearest = tempNearest;
-        // std::cout << "2" << std::endl;
-    }else {
-        //go right WITHING this box
-        left = false;
-        Node *tempNearest = nearestSearch(root->right, key, depth+1, nearest, minDistance);
-        if(tempNearest != NULL) nearest = tempNearest;
-        
-        // std::cout << "3" << std::endl;
+    size_t size = (size_t)info.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) return false;
+
+    const SnapshotHeader *header = (const SnapshotHeader *)data;
+    bool valid = std::memcmp(header->magic, SNAPSHOT_MAGIC, 4) == 0
+        && header->version == SNAPSHOT_VERSION
+        && header->hash == hash
+        && header->nodeSize == sizeof(PackedPhoton)
+        && size == sizeof(SnapshotHeader) + header->count * sizeof(PackedPhoton);
+    if(!valid) {
+        munmap(data, size);
+        return false;
     }
-    //update distance
-    // std::cout << nearest->loc[axis] << std::endl;
-    minDistance = glm::distance(nearest->loc, key);
-    //distance from OUTER box
-    float boxDistance = glm::abs(key[axis] - root->loc[axis]);
-    if(boxDistance < minDistance) {
-        //go other way
-        if(left) {
-            Node *tempNearest = nearestSearch(root->right, key, depth+1, nearest, minDistance);
-            if(tempNearest != NULL) nearest = tempNearest;
-        } else {
-            Node *tempNearest = nearestSearch(root->left, key, depth+1, nearest, minDistance);
-            if(tempNearest != NULL) nearest = tempNearest;
-        }
-        minDistance = glm::distance(nearest->loc, key);
+    mapping = data;
+    mappingSize = size;
+    nodes = (const PackedPhoton *)((const char *)data + sizeof(SnapshotHeader));
+    count = header->count;
+    lower = glm::vec3(header->lower[0], header->lower[1], header->lower[2]);
+    step = header->step;
+    return true;
+}
+
+void KDTree::release() {
+    if(mapping != NULL) munmap(mapping, mappingSize);
+    mapping = NULL;
+    mappingSize = 0;
+    std::vector<PackedPhoton>().swap(storage);
+    nodes = NULL;
+    count = 0;
+    lower = glm::vec3(0);
+    step = 0;
+}
+
+KDTree::KDTree(const std::vector<PhotonRecord> &photons) : nodes(NULL), count(0), lower(0), step(0), mapping(NULL), mappingSize(0) {
+    TraceScope scope("kd-tree build");
+    if(photons.empty()) return;
+    glm::vec3 upper = photons[0].loc;
+    lower = upper;
+    for(size_t i = 0; i < photons.size(); i++) {
+        lower = glm::min(lower, photons[i].loc);
+        upper = glm::max(upper, photons[i].loc);
+    }
+    glm::vec3 extent = upper - lower;
+    step = glm::max(extent.x, glm::max(extent.y, extent.z)) / 65535.0f;
+    if(step == 0) step = 1;
+
+    //pack first and split on the quantized positions, so the tree is consistent with what queries see
+    std::vector<PackedPhoton> packed(photons.size());
+    for(size_t i = 0; i < photons.size(); i++) {
+        glm::vec3 q = glm::clamp(glm::floor((photons[i].loc - lower) / step + 0.5f), 0.0f, 65535.0f);
+        for(int a = 0; a < 3; a++) packed[i].position[a] = (uint16_t)q[a];
+        packPower(photons[i].power, packed[i].power);
+        packDirection(photons[i].direction, packed[i].direction);
     }
+    std::vector<int32_t> order(photons.size());
+    for(size_t i = 0; i < order.size(); i++) order[i] = (int32_t)i;
+    storage.resize(photons.size());
+    build(packed, order, 0, (int)photons.size(), 0, 0);
+    nodes = storage.data();
+    count = storage.size();
+}
 
-    return nearest;
+KDTree::KDTree() : nodes(NULL), count(0), lower(0), step(0), mapping(NULL), mappingSize(0) {}
+
+KDTree::KDTree(KDTree &&other) : nodes(NULL), count(0), lower(0), step(0), mapping(NULL), mappingSize(0) {
+    *this = std::move(other);
 }
 
-std::vector<Node*> KDTree::beginSearch(glm::vec3 loc) {
-    traversed.clear();
-    Node* nearest = nearestSearch(root, loc, 0, NULL, INFINITY);
-   
-    traversed.push_back(nearest);
-        // std::cout << "4" << std::endl;
-    return traversed;
+KDTree &KDTree::operator=(KDTree &&other) {
+    if(this != &other) {
+        release();
+        storage.swap(other.storage);
+        nodes = other.nodes;
+        count = other.count;
+        lower = other.lower;
+        step = other.step;
+        mapping = other.mapping;
+        mappingSize = other.mappingSize;
+        other.nodes = NULL;
+        other.count = 0;
+        other.lower = glm::vec3(0);
+        other.step = 0;
+        other.mapping = NULL;
+        other.mappingSize = 0;
+    }
+    return *this;
 }
 
-KDTree::KDTree(glm::vec4 value) {
-    root = new Node{glm::vec3(value[0], value[1], value[2]), value[3], NULL, NULL};
+KDTree::~KDTree() {
+    release();
 }
-KDTree::KDTree() {
-    root = NULL;
-}
\ No newline at end of file
@@ -1,27 +1,50 @@
 #pragma once
 
-#include "glm/glm.hpp"
+#include "PhotonLookup.h"
+#include "PackedPhoton.h"
 #include <vector>
+#include <string>
+#include <cstdint>
 #include <iostream>
 
-struct Node {
-    glm::vec3 loc;
-    float intensity;
-    Node* left;
-    Node* right;
-};
-
-class KDTree {
+//Photons are stored packed, as a left-balanced tree in one flat array: node i's children are 2i + 1 and 2i + 2
+//and the splitting axis is the depth mod 3, so nodes hold no links at all and a built tree can be written out
+//and mapped straight back in. Positions are quantized inside the bounds of the photons the tree was built from.
+class KDTree : public PhotonLookup {
 public:
-    Node *root;
+    int radiusSearch(glm::vec3 loc, float radius, PhotonHit *hits, int capacity) const;
+    int kNearest(glm::vec3 loc, int k, PhotonHit *hits) const;
+    size_t size() const;
+    size_t memoryUsage() const;
+    //Decoded fields of the photon at index (as in PhotonHit::index)
+    glm::vec3 position(size_t index) const;
+    glm::vec3 power(size_t index) const;
+    glm::vec3 direction(size_t index) const;
 
-    std::vector<Node*> beginSearch(glm::vec3 loc);
+    //Snapshot the tree to disk, or map a snapshot back in. load() refuses (and leaves the tree empty)
+    //if the file is missing, truncated, or was written for a different scene hash.
+    bool save(const std::string &path, uint64_t hash) const;
+    bool load(const std::string &path, uint64_t hash);
 
-    Node *insert(Node *root, glm::vec4 value, int depth);
-    Node *nearestSearch(Node *root, glm::vec3 key, int depth, Node* nearest, float distance);
-    KDTree(glm::vec4 value);
+    //Builds a balanced tree by splitting on the median along x, y, z in turn
+    KDTree(const std::vector<PhotonRecord> &photons);
     KDTree();
+    KDTree(KDTree &&other);
+    KDTree &operator=(KDTree &&other);
+    KDTree(const KDTree &) = delete;
+    KDTree &operator=(const KDTree &) = delete;
+    ~KDTree();
 private:
-    std::vector<Node*> traversed; //clear this
+    std::vector<PackedPhoton> storage;
+    const PackedPhoton *nodes;
+    size_t count;
+    //position = lower + quantized * step (the same step on every axis)
+    glm::vec3 lower;
+    float step;
+    void *mapping;
+    size_t mappingSize;
 
-};
\ No newline at end of file
+    void build(const std::vector<PackedPhoton> &packed, std::vector<int32_t> &order, int begin, int end, size_t index, int depth);
+    void gather(size_t index, glm::vec3 key, int depth, float &maxDistance2, PhotonHit *heap, int &found, int capacity) const;
+    void release();
+};
@@ -0,0 +1,41 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool MappedFile::isOpen() const {
+    return open;
+}
+
+const char *MappedFile::data() const {
+    return (const char *)mapping;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+MappedFile::MappedFile(const std::string &path) : mapping(NULL), length(0), open(false) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat info;
+    if(fstat(fd, &info) == 0) {
+        if(info.st_size == 0) open = true;
+        else {
+            void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data != MAP_FAILED) {
+                //the parsers read front to back
+                madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+                mapping = data;
+                length = (size_t)info.st_size;
+                open = true;
+            }
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if(mapping != NULL) munmap(mapping, length);
+}
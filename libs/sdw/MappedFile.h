@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+//A whole file mapped read-only into memory. data() is NULL (and size() 0) if it couldn't be opened;
+//an empty file opens fine with size() 0.
+class MappedFile {
+public:
+    bool isOpen() const;
+    const char *data() const;
+    size_t size() const;
+
+    MappedFile(const std::string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+private:
+    void *mapping;
+    size_t length;
+    bool open;
+};
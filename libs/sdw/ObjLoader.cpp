@@ -0,0 +1,328 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <thread>
+
+//Files are only split into chunks of at least this many bytes
+#define MIN_CHUNK (1 << 20)
+
+//Parsing works on [begin, end) ranges of the mapped file, so nothing is copied until a value is stored
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static const char *skipSpaces(const char *p, const char *end) {
+    while(p < end && isSpace(*p)) p++;
+    return p;
+}
+
+static const char *tokenEnd(const char *p, const char *end) {
+    while(p < end && !isSpace(*p) && *p != '\n') p++;
+    return p;
+}
+
+static bool tokenIs(const char *begin, const char *end, const char *word) {
+    size_t length = std::strlen(word);
+    return (size_t)(end - begin) == length && std::memcmp(begin, word, length) == 0;
+}
+
+//Decimal float ([sign] digits [. digits] [e [sign] digits]); leaves value alone and returns p if there's no number
+static const char *parseFloat(const char *p, const char *end, float &value) {
+    static const double POWERS[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int significant = 0;
+    bool any = false;
+    for(; p < end && isDigit(*p); p++, any = true) {
+        //past 19 significant digits only the magnitude matters
+        if(significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if(mantissa != 0) significant++;
+        } else exponent++;
+    }
+    if(p < end && *p == '.') {
+        for(p++; p < end && isDigit(*p); p++, any = true) {
+            if(significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if(mantissa != 0) significant++;
+                exponent--;
+            }
+        }
+    }
+    if(!any) return start;
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if(q < end && (*q == '-' || *q == '+')) negativeExponent = *q++ == '-';
+        if(q < end && isDigit(*q)) {
+            int e = 0;
+            for(; q < end && isDigit(*q); q++) if(e < 10000) e = e * 10 + (*q - '0');
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+    double result = (double)mantissa;
+    if(exponent < 0) result = exponent >= -22 ? result / POWERS[-exponent] : result * std::pow(10.0, exponent);
+    else if(exponent > 0) result = exponent <= 22 ? result * POWERS[exponent] : result * std::pow(10.0, exponent);
+    value = (float)(negative ? -result : result);
+    return p;
+}
+
+static const char *parseInt(const char *p, const char *end, int64_t &value) {
+    const char *start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if(p == end || !isDigit(*p)) return start;
+    int64_t result = 0;
+    for(; p < end && isDigit(*p); p++) if(result < ((int64_t)1 << 40)) result = result * 10 + (*p - '0');
+    value = negative ? -result : result;
+    return p;
+}
+
+//1-based (or negative, counting back from the latest) OBJ index to a 0-based one, -1 if it's out of range
+static int32_t resolveIndex(int64_t index, size_t count) {
+    int64_t resolved = index > 0 ? index - 1 : (int64_t)count + index;
+    return index != 0 && resolved >= 0 && resolved < (int64_t)count ? (int32_t)resolved : -1;
+}
+
+static std::string directoryOf(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+bool loadMaterialLibrary(const std::string &path, std::vector<Material> &materials) {
+    MappedFile file(path);
+    if(!file.isOpen()) return false;
+    const char *p = file.data();
+    const char *end = p + file.size();
+    Material *current = NULL;
+    while(p < end) {
+        p = skipSpaces(p, end);
+        const char *keyword = p;
+        p = tokenEnd(p, end);
+        const char *keywordEnd = p;
+        p = skipSpaces(p, end);
+        if(tokenIs(keyword, keywordEnd, "newmtl")) {
+            const char *nameEnd = tokenEnd(p, end);
+            std::string name(p, nameEnd);
+            materials.push_back(Material(Colour(), "", name));
+            if(name == "Mirror") materials.back().mirror = true;
+            current = &materials.back();
+        } else if(current != NULL && tokenIs(keyword, keywordEnd, "Kd")) {
+            float kd[3] = {0, 0, 0};
+            for(int c = 0; c < 3; c++) p = parseFloat(skipSpaces(p, end), end, kd[c]);
+            current->colour = Colour(0xFF * kd[0], 0xFF * kd[1], 0xFF * kd[2]);
+        } else if(current != NULL && tokenIs(keyword, keywordEnd, "map_Kd")) {
+            current->texturePath = std::string(p, tokenEnd(p, end));
+        }
+        const char *newline = (const char *)std::memchr(p, '\n', end - p);
+        p = newline == NULL ? end : newline + 1;
+    }
+    return true;
+}
+
+//Everything one chunk of an OBJ holds, parsed without knowing what came before it. Face corners keep their
+//indices as written, with the chunk's element counts at that face, so they can be resolved once the counts
+//of earlier chunks are known; materials are settled in order afterwards from the chunk's statements.
+struct ObjStatement {
+    bool library;
+    std::string name;
+};
+
+struct ObjChunkFace {
+    uint32_t firstCorner;
+    uint32_t cornerCount;
+    uint32_t counts[3];
+    //the chunk's last usemtl statement before this face, -1 to carry on with the material the chunk started with
+    int32_t statement;
+};
+
+struct ObjChunk {
+    std::vector<glm::vec3> vertices;
+    std::vector<TexturePoint> texturePoints;
+    std::vector<glm::vec3> normals;
+    std::vector<int64_t> corners;
+    std::vector<ObjChunkFace> faces;
+    std::vector<ObjStatement> statements;
+    std::vector<ObjTriangle> triangles;
+};
+
+static void parseChunk(const char *p, const char *end, ObjChunk &chunk) {
+    int32_t statement = -1;
+    while(p < end) {
+        p = skipSpaces(p, end);
+        const char *keyword = p;
+        p = tokenEnd(p, end);
+        const char *keywordEnd = p;
+        p = skipSpaces(p, end);
+        size_t keywordLength = keywordEnd - keyword;
+        if(keywordLength == 1 && keyword[0] == 'v') {
+            glm::vec3 vertex(0);
+            for(int a = 0; a < 3; a++) p = parseFloat(skipSpaces(p, end), end, vertex[a]);
+            chunk.vertices.push_back(vertex);
+        } else if(keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+            float u = 0, v = 0;
+            p = parseFloat(p, end, u);
+            p = parseFloat(skipSpaces(p, end), end, v);
+            chunk.texturePoints.push_back(TexturePoint(u, v));
+        } else if(keywordLength == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+            glm::vec3 normal(0);
+            for(int a = 0; a < 3; a++) p = parseFloat(skipSpaces(p, end), end, normal[a]);
+            chunk.normals.push_back(normal);
+        } else if(keywordLength == 1 && keyword[0] == 'f') {
+            ObjChunkFace face = {(uint32_t)chunk.corners.size() / 3, 0,
+                {(uint32_t)chunk.vertices.size(), (uint32_t)chunk.texturePoints.size(), (uint32_t)chunk.normals.size()}, statement};
+            //v, v/vt, v//vn or v/vt/vn (vt may also be left empty, as in "v/")
+            while(p < end && *p != '\n') {
+                int64_t index[3] = {0, 0, 0};
+                const char *next = parseInt(p, end, index[0]);
+                if(next == p) break;
+                p = next;
+                for(int k = 1; k < 3 && p < end && *p == '/'; k++) p = parseInt(p + 1, end, index[k]);
+                chunk.corners.insert(chunk.corners.end(), index, index + 3);
+                face.cornerCount++;
+                p = skipSpaces(tokenEnd(p, end), end);
+            }
+            chunk.faces.push_back(face);
+        } else if(tokenIs(keyword, keywordEnd, "usemtl")) {
+            statement = (int32_t)chunk.statements.size();
+            chunk.statements.push_back(ObjStatement{false, std::string(p, tokenEnd(p, end))});
+        } else if(tokenIs(keyword, keywordEnd, "mtllib")) {
+            while(p < end && *p != '\n') {
+                const char *nameEnd = tokenEnd(p, end);
+                chunk.statements.push_back(ObjStatement{true, std::string(p, nameEnd)});
+                p = skipSpaces(nameEnd, end);
+            }
+        }
+        const char *newline = (const char *)std::memchr(p, '\n', end - p);
+        p = newline == NULL ? end : newline + 1;
+    }
+}
+
+//Turn a chunk's faces into triangles now that the element counts before it (bases) and the material of each of
+//its usemtl statements are known. Faces referring to vertices that don't exist are dropped, missing texture
+//points and normals become -1, and polygons are fanned out from their first corner.
+static void resolveChunk(ObjChunk &chunk, const size_t bases[3], int32_t material, const std::vector<int32_t> &statementMaterials) {
+    std::vector<int32_t> corners;
+    for(size_t f = 0; f < chunk.faces.size(); f++) {
+        const ObjChunkFace &face = chunk.faces[f];
+        corners.clear();
+        bool valid = true;
+        for(uint32_t c = 0; c < face.cornerCount; c++) {
+            const int64_t *index = &chunk.corners[(size_t)(face.firstCorner + c) * 3];
+            for(int k = 0; k < 3; k++) corners.push_back(resolveIndex(index[k], bases[k] + face.counts[k]));
+            if(corners[c * 3] < 0) valid = false;
+        }
+        int32_t faceMaterial = face.statement < 0 ? material : statementMaterials[face.statement];
+        for(size_t c = 2; valid && c < face.cornerCount; c++) {
+            ObjTriangle triangle;
+            size_t fan[3] = {0, c - 1, c};
+            for(int k = 0; k < 3; k++) {
+                triangle.vertices[k] = corners[fan[k] * 3];
+                triangle.texturePoints[k] = corners[fan[k] * 3 + 1];
+                triangle.normals[k] = corners[fan[k] * 3 + 2];
+            }
+            triangle.material = faceMaterial;
+            chunk.triangles.push_back(triangle);
+        }
+    }
+    std::vector<int64_t>().swap(chunk.corners);
+    std::vector<ObjChunkFace>().swap(chunk.faces);
+}
+
+//Run body(chunk) for every chunk, one thread each
+template<typename Body>
+static void forEachChunk(size_t chunks, Body body) {
+    std::vector<std::thread> workers;
+    for(size_t c = 1; c < chunks; c++) workers.push_back(std::thread(body, c));
+    body(0);
+    for(size_t w = 0; w < workers.size(); w++) workers[w].join();
+}
+
+template<typename T>
+static void appendAll(std::vector<T> &to, const std::vector<ObjChunk> &chunks, std::vector<T> ObjChunk::*member) {
+    size_t total = to.size();
+    for(size_t c = 0; c < chunks.size(); c++) total += (chunks[c].*member).size();
+    to.reserve(total);
+    for(size_t c = 0; c < chunks.size(); c++) to.insert(to.end(), (chunks[c].*member).begin(), (chunks[c].*member).end());
+}
+
+bool loadObjMesh(const std::string &path, ObjMesh &mesh, int threads) {
+    MappedFile file(path);
+    if(!file.isOpen()) return false;
+    std::string directory = directoryOf(path);
+
+    //split at line starts, at most one chunk per thread and none smaller than MIN_CHUNK
+    const char *data = file.data();
+    const char *end = data + file.size();
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threads, file.size() / MIN_CHUNK));
+    std::vector<const char *> bounds(1, data);
+    for(size_t c = 1; c < chunkCount; c++) {
+        const char *split = std::max(bounds.back(), data + file.size() * c / chunkCount);
+        const char *newline = (const char *)std::memchr(split, '\n', end - split);
+        bounds.push_back(newline == NULL ? end : newline + 1);
+    }
+    bounds.push_back(end);
+    std::vector<ObjChunk> chunks(chunkCount);
+    forEachChunk(chunkCount, [&chunks, &bounds](size_t c) { parseChunk(bounds[c], bounds[c + 1], chunks[c]); });
+
+    //settle materials in file order: libraries are read as they're named, and usemtl picks the latest
+    //material of that name (or adds a plain one)
+    std::unordered_map<std::string, int32_t> materialIndex;
+    std::vector<int32_t> incoming(chunkCount);
+    std::vector<std::vector<int32_t> > statementMaterials(chunkCount);
+    int32_t material = -1;
+    for(size_t c = 0; c < chunkCount; c++) {
+        incoming[c] = material;
+        statementMaterials[c].assign(chunks[c].statements.size(), -1);
+        for(size_t s = 0; s < chunks[c].statements.size(); s++) {
+            const ObjStatement &statement = chunks[c].statements[s];
+            if(statement.library) {
+                size_t first = mesh.materials.size();
+                std::string library = directory + statement.name;
+                if(loadMaterialLibrary(library, mesh.materials)) mesh.libraries.push_back(library);
+                for(size_t m = first; m < mesh.materials.size(); m++) materialIndex[mesh.materials[m].name] = (int32_t)m;
+                continue;
+            }
+            std::unordered_map<std::string, int32_t>::iterator found = materialIndex.find(statement.name);
+            if(found != materialIndex.end()) material = found->second;
+            else {
+                //not in any library: plain material of that name
+                material = (int32_t)mesh.materials.size();
+                mesh.materials.push_back(Material(Colour(), "", statement.name));
+                if(statement.name == "Mirror") mesh.materials.back().mirror = true;
+                materialIndex[statement.name] = material;
+            }
+            statementMaterials[c][s] = material;
+        }
+    }
+
+    //indices continue from whatever the mesh already held and the chunks before
+    std::vector<size_t> bases(chunkCount * 3);
+    size_t running[3] = {mesh.vertices.size(), mesh.texturePoints.size(), mesh.normals.size()};
+    for(size_t c = 0; c < chunkCount; c++) {
+        for(int k = 0; k < 3; k++) bases[c * 3 + k] = running[k];
+        running[0] += chunks[c].vertices.size();
+        running[1] += chunks[c].texturePoints.size();
+        running[2] += chunks[c].normals.size();
+    }
+    forEachChunk(chunkCount, [&chunks, &bases, &incoming, &statementMaterials](size_t c) {
+        resolveChunk(chunks[c], &bases[c * 3], incoming[c], statementMaterials[c]);
+    });
+    appendAll(mesh.vertices, chunks, &ObjChunk::vertices);
+    appendAll(mesh.texturePoints, chunks, &ObjChunk::texturePoints);
+    appendAll(mesh.normals, chunks, &ObjChunk::normals);
+    appendAll(mesh.triangles, chunks, &ObjChunk::triangles);
+    return true;
+}
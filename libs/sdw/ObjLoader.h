@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Material.h"
+#include "TexturePoint.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//A triangle as indices into its mesh's tables; -1 where the face gave no texture point or normal,
+//and for the material of faces before any usemtl
+struct ObjTriangle {
+    int32_t vertices[3];
+    int32_t texturePoints[3];
+    int32_t normals[3];
+    int32_t material;
+};
+
+struct ObjMesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<TexturePoint> texturePoints;
+    std::vector<glm::vec3> normals;
+    std::vector<Material> materials;
+    std::vector<ObjTriangle> triangles;
+    //MTL files that were read, as opened
+    std::vector<std::string> libraries;
+};
+
+//Parse an OBJ file and the MTL libraries it names (resolved against the OBJ's directory), each read once.
+//Faces with more than three corners are fanned into triangles, negative indices count back from the latest
+//element, and faces referring to vertices that don't exist are dropped. Returns false if the file can't be read.
+//Large files are split at line boundaries and parsed on up to `threads` threads; the mesh is the same either way.
+bool loadObjMesh(const std::string &path, ObjMesh &mesh, int threads = 1);
+
+//Append every material in an MTL file (newmtl, Kd, map_Kd) to materials. A material named "Mirror" is a mirror.
+bool loadMaterialLibrary(const std::string &path, std::vector<Material> &materials);
@@ -0,0 +1,22 @@
+#include "PCG32.h"
+
+PCG32::PCG32(uint64_t seed, uint64_t stream) {
+    state = 0;
+    inc = (stream << 1) | 1;
+    next();
+    state += seed;
+    next();
+}
+
+uint32_t PCG32::next() {
+    uint64_t old = state;
+    state = old * 6364136223846793005ULL + inc;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+float PCG32::nextFloat() {
+    //top 24 bits so the result is exactly representable and never rounds up to 1
+    return (next() >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+//Small fast PRNG (PCG-XSH-RR). Each (seed, stream) pair gives an independent sequence,
+//so work items can own a generator keyed by their index instead of sharing rand().
+class PCG32 {
+public:
+    PCG32(uint64_t seed, uint64_t stream);
+    uint32_t next();
+    //Uniform in [0, 1)
+    float nextFloat();
+private:
+    uint64_t state;
+    uint64_t inc;
+};
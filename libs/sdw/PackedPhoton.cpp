@@ -0,0 +1,49 @@
+#include "PackedPhoton.h"
+#include <cmath>
+
+void packPower(glm::vec3 power, uint8_t *rgbe) {
+    float largest = glm::max(power.r, glm::max(power.g, power.b));
+    if(!(largest > 1e-32f)) {
+        rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+        return;
+    }
+    int exponent;
+    float mantissa = std::frexp(largest, &exponent);
+    //largest * scale lands in [128, 256)
+    float scale = mantissa * 256.0f / largest;
+    for(int c = 0; c < 3; c++) rgbe[c] = (uint8_t)glm::min(255.0f, glm::max(0.0f, power[c]) * scale + 0.5f);
+    rgbe[3] = (uint8_t)(exponent + 128);
+}
+
+glm::vec3 unpackPower(const uint8_t *rgbe) {
+    if(rgbe[3] == 0) return glm::vec3(0);
+    float scale = std::ldexp(1.0f, (int)rgbe[3] - (128 + 8));
+    return glm::vec3(rgbe[0], rgbe[1], rgbe[2]) * scale;
+}
+
+float unpackIntensity(const uint8_t *rgbe) {
+    if(rgbe[3] == 0) return 0.0f;
+    return ((int)rgbe[0] + rgbe[1] + rgbe[2]) * std::ldexp(1.0f, (int)rgbe[3] - (128 + 8)) * (1.0f / 3.0f);
+}
+
+void packDirection(glm::vec3 direction, uint8_t *octahedral) {
+    //project onto the octahedron |x|+|y|+|z| = 1, then fold the lower half out over the corners
+    float sum = glm::abs(direction.x) + glm::abs(direction.y) + glm::abs(direction.z);
+    glm::vec2 p = sum > 0 ? glm::vec2(direction.x, direction.y) / sum : glm::vec2(0);
+    if(direction.z < 0) {
+        glm::vec2 folded = 1.0f - glm::abs(glm::vec2(p.y, p.x));
+        p = glm::vec2(p.x >= 0 ? folded.x : -folded.x, p.y >= 0 ? folded.y : -folded.y);
+    }
+    for(int a = 0; a < 2; a++) octahedral[a] = (uint8_t)glm::clamp(glm::floor((p[a] * 0.5f + 0.5f) * 255.0f + 0.5f), 0.0f, 255.0f);
+}
+
+glm::vec3 unpackDirection(const uint8_t *octahedral) {
+    glm::vec2 p = glm::vec2(octahedral[0], octahedral[1]) * (2.0f / 255.0f) - 1.0f;
+    glm::vec3 direction(p.x, p.y, 1.0f - glm::abs(p.x) - glm::abs(p.y));
+    if(direction.z < 0) {
+        glm::vec2 folded = 1.0f - glm::abs(glm::vec2(p.y, p.x));
+        direction.x = p.x >= 0 ? folded.x : -folded.x;
+        direction.y = p.y >= 0 ? folded.y : -folded.y;
+    }
+    return glm::normalize(direction);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <cstdint>
+
+//A photon in 12 bytes: position quantized to 16 bits per axis (relative to bounds kept by its owner),
+//power as shared-exponent RGB (RGBE) and the incident direction octahedral-encoded into 8+8 bits
+struct PackedPhoton {
+    uint16_t position[3];
+    uint8_t power[4];
+    uint8_t direction[2];
+};
+
+//RGBE: three 8 bit mantissas sharing the exponent of the largest channel (~0.4% relative error)
+void packPower(glm::vec3 power, uint8_t *rgbe);
+glm::vec3 unpackPower(const uint8_t *rgbe);
+//Mean of the three channels, for the estimates that only want a scalar
+float unpackIntensity(const uint8_t *rgbe);
+
+//Octahedral mapping of a unit vector onto a square, quantized to 8 bits per axis (~1 degree)
+void packDirection(glm::vec3 direction, uint8_t *octahedral);
+glm::vec3 unpackDirection(const uint8_t *octahedral);
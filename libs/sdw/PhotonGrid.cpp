@@ -0,0 +1,94 @@
+#include "PhotonGrid.h"
+#include "TraceEvents.h"
+
+//Above this many cells a query falls back to scanning every photon
+#define MAX_SCANNED_CELLS 512
+
+uint32_t PhotonGrid::bucket(int x, int y, int z) const {
+    return ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u) & mask;
+}
+
+void PhotonGrid::scanBucket(uint32_t b, glm::vec3 key, float &maxDistance2, PhotonHit *heap, int &found, int capacity) const {
+    for(uint32_t i = bucketStart[b]; i < bucketStart[b + 1]; i++) {
+        glm::vec3 offset = photons[i].loc - key;
+        float distance2 = glm::dot(offset, offset);
+        if(distance2 < maxDistance2) maxDistance2 = offerHit(heap, found, capacity, PhotonHit{i, photons[i].intensity, distance2}, maxDistance2);
+    }
+}
+
+int PhotonGrid::radiusSearch(glm::vec3 loc, float radius, PhotonHit *hits, int capacity) const {
+    int found = 0;
+    if(capacity <= 0 || photons.empty()) return found;
+    float maxDistance2 = radius * radius;
+    glm::ivec3 from = glm::ivec3(glm::floor((loc - radius) / cellSize));
+    glm::ivec3 to = glm::ivec3(glm::floor((loc + radius) / cellSize));
+    glm::ivec3 span = to - from + 1;
+    long long cells = (long long)span.x * span.y * span.z;
+    if(cells > MAX_SCANNED_CELLS || cells >= (long long)mask + 1) {
+        //the sphere covers so much of the grid that scanning every photon is cheaper
+        for(uint32_t b = 0; b <= mask; b++) scanBucket(b, loc, maxDistance2, hits, found, capacity);
+        return found;
+    }
+    //different cells can hash to the same bucket, so scan each distinct bucket once
+    uint32_t buckets[MAX_SCANNED_CELLS];
+    int bucketCount = 0;
+    for(int x = from.x; x <= to.x; x++) {
+        for(int y = from.y; y <= to.y; y++) {
+            for(int z = from.z; z <= to.z; z++) buckets[bucketCount++] = bucket(x, y, z);
+        }
+    }
+    std::sort(buckets, buckets + bucketCount);
+    bucketCount = (int)(std::unique(buckets, buckets + bucketCount) - buckets);
+    for(int i = 0; i < bucketCount; i++) scanBucket(buckets[i], loc, maxDistance2, hits, found, capacity);
+    return found;
+}
+
+int PhotonGrid::kNearest(glm::vec3 loc, int k, PhotonHit *hits) const {
+    if(k <= 0 || photons.empty()) return 0;
+    //grow the search radius until k photons are inside it; nothing outside can then be closer
+    float reach = glm::length(glm::max(glm::abs(loc - lower), glm::abs(loc - upper)));
+    float radius = cellSize;
+    int found = radiusSearch(loc, radius, hits, k);
+    while(found < k && radius < reach) {
+        radius *= 2;
+        found = radiusSearch(loc, radius, hits, k);
+    }
+    return found;
+}
+
+size_t PhotonGrid::size() const {
+    return photons.size();
+}
+
+size_t PhotonGrid::memoryUsage() const {
+    return photons.size() * sizeof(Photon) + bucketStart.size() * sizeof(uint32_t);
+}
+
+PhotonGrid::PhotonGrid(const std::vector<PhotonRecord> &input, float cellSize) : cellSize(cellSize), mask(0), lower(0), upper(0) {
+    TraceScope scope("photon grid build");
+    uint32_t tableSize = 1;
+    while(tableSize < input.size()) tableSize <<= 1;
+    mask = tableSize - 1;
+
+    //counting sort by bucket
+    std::vector<uint32_t> buckets(input.size());
+    bucketStart.assign(tableSize + 1, 0);
+    if(!input.empty()) lower = upper = input[0].loc;
+    for(size_t i = 0; i < input.size(); i++) {
+        glm::ivec3 cell = glm::ivec3(glm::floor(input[i].loc / cellSize));
+        buckets[i] = bucket(cell.x, cell.y, cell.z);
+        bucketStart[buckets[i] + 1]++;
+        lower = glm::min(lower, input[i].loc);
+        upper = glm::max(upper, input[i].loc);
+    }
+    for(uint32_t b = 0; b < tableSize; b++) bucketStart[b + 1] += bucketStart[b];
+    std::vector<uint32_t> next(bucketStart.begin(), bucketStart.end() - 1);
+    photons.resize(input.size());
+    for(size_t i = 0; i < input.size(); i++) {
+        Photon &photon = photons[next[buckets[i]]++];
+        photon.loc = input[i].loc;
+        photon.intensity = (input[i].power.r + input[i].power.g + input[i].power.b) / 3.0f;
+    }
+}
+
+PhotonGrid::PhotonGrid() : cellSize(1), mask(0), lower(0), upper(0) {}
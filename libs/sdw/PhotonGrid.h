@@ -0,0 +1,32 @@
+#pragma once
+
+#include "PhotonLookup.h"
+#include <vector>
+#include <cstdint>
+
+//Photons bucketed into a hashed uniform grid. Cells are cellSize wide and hashed into a table sized to the
+//photon count, and photons are sorted by bucket so each one is a contiguous run. A radius query scans every
+//cell the search sphere's bounding box overlaps: with cellSize equal to the gather radius that is up to 3 per
+//axis, 27 in all, which is still less volume than the 8 cells of twice the radius a 2x2x2 scan would need.
+class PhotonGrid : public PhotonLookup {
+public:
+    int radiusSearch(glm::vec3 loc, float radius, PhotonHit *hits, int capacity) const;
+    int kNearest(glm::vec3 loc, int k, PhotonHit *hits) const;
+    size_t size() const;
+    size_t memoryUsage() const;
+
+    //Keeps each photon's position and mean power
+    PhotonGrid(const std::vector<PhotonRecord> &photons, float cellSize);
+    PhotonGrid();
+private:
+    float cellSize;
+    uint32_t mask;
+    //bucket b holds photons[bucketStart[b]] up to (not including) photons[bucketStart[b + 1]]
+    std::vector<uint32_t> bucketStart;
+    std::vector<Photon> photons;
+    glm::vec3 lower;
+    glm::vec3 upper;
+
+    uint32_t bucket(int x, int y, int z) const;
+    void scanBucket(uint32_t b, glm::vec3 key, float &maxDistance2, PhotonHit *heap, int &found, int capacity) const;
+};
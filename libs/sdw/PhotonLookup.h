@@ -0,0 +1,57 @@
+#pragma once
+
+#include "glm/glm.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+//A photon as traced, before it's stored: where it landed, its RGB power and the direction it arrived from
+struct PhotonRecord {
+    glm::vec3 loc;
+    glm::vec3 power;
+    glm::vec3 direction;
+};
+
+struct Photon {
+    glm::vec3 loc;
+    float intensity;
+};
+
+//A photon found by a query: its index in the structure, its (scalar) intensity and its squared distance
+//to the query point
+struct PhotonHit {
+    uint32_t index;
+    float intensity;
+    float distance2;
+};
+
+//Common interface for the structures photons can be gathered from
+class PhotonLookup {
+public:
+    //Both queries write into hits (caller owns it, nothing is allocated) and return how many were found.
+    //radiusSearch keeps the closest `capacity` photons within radius, kNearest the closest k overall.
+    virtual int radiusSearch(glm::vec3 loc, float radius, PhotonHit *hits, int capacity) const = 0;
+    virtual int kNearest(glm::vec3 loc, int k, PhotonHit *hits) const = 0;
+    virtual size_t size() const = 0;
+    //Bytes held by the structure itself
+    virtual size_t memoryUsage() const = 0;
+    virtual ~PhotonLookup() {}
+};
+
+inline bool closerHit(const PhotonHit &a, const PhotonHit &b) {
+    return a.distance2 < b.distance2;
+}
+
+//Offer a photon to a bounded max-heap of hits, so the worst kept photon is always heap[0].
+//Returns the squared distance a later photon has to beat to be kept.
+inline float offerHit(PhotonHit *heap, int &found, int capacity, PhotonHit hit, float maxDistance2) {
+    if(found < capacity) {
+        heap[found++] = hit;
+        std::push_heap(heap, heap + found, closerHit);
+    } else {
+        std::pop_heap(heap, heap + found, closerHit);
+        heap[found - 1] = hit;
+        std::push_heap(heap, heap + found, closerHit);
+    }
+    return found == capacity ? heap[0].distance2 : maxDistance2;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//Fixed-size lock-free queue for exactly one producer thread and one consumer thread. Holds up to N - 1 items.
+template <typename T, size_t N>
+class SPSCQueue {
+public:
+    //Producer only. False (and the item is not queued) when full.
+    bool push(const T &item) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % N;
+        if(next == head.load(std::memory_order_acquire)) return false;
+        items[tail] = item;
+        this->tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    //Consumer only. False when empty.
+    bool pop(T &item) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if(head == tail.load(std::memory_order_acquire)) return false;
+        item = items[head];
+        this->head.store((head + 1) % N, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    SPSCQueue() : head(0), tail(0) {}
+private:
+    T items[N];
+    //on separate cache lines so the two threads don't keep stealing each other's
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
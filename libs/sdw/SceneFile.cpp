@@ -0,0 +1,285 @@
+#include "SceneFile.h"
+#include "ObjLoader.h"
+#include "TraceEvents.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+//On-disk layout: this header, then each section 8-byte aligned at its offset
+struct SceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    float scale;
+    uint32_t sectionCount;
+    uint64_t offsets[SCENE_SECTIONS];
+    uint64_t counts[SCENE_SECTIONS];
+};
+
+static const char SCENE_MAGIC[4] = {'S', 'C', 'N', 'E'};
+static const uint32_t SCENE_VERSION = 1;
+static const size_t SECTION_SIZES[SCENE_SECTIONS] = {sizeof(glm::vec3), sizeof(glm::vec2), sizeof(glm::vec3),
+    sizeof(SceneTriangle), sizeof(SceneMaterial), sizeof(SceneTexture), sizeof(uint32_t), sizeof(SceneString), 1};
+
+//FNV-1a over the path and contents of every source, a word at a time
+//The first objCount sources are the OBJs the scene was compiled from, the rest their material libraries
+static uint64_t hashSources(const std::vector<std::string> &sources, size_t objCount, float scale) {
+    uint64_t hash = 14695981039346656037ULL;
+    const uint64_t prime = 1099511628211ULL;
+    hash = (hash ^ objCount) * prime;
+    uint32_t scaleBits;
+    std::memcpy(&scaleBits, &scale, sizeof(scaleBits));
+    hash = (hash ^ scaleBits) * prime;
+    for(size_t s = 0; s < sources.size(); s++) {
+        for(size_t i = 0; i < sources[s].size(); i++) hash = (hash ^ (uint8_t)sources[s][i]) * prime;
+        MappedFile file(sources[s]);
+        //a missing source hashes differently from an empty one
+        hash = (hash ^ (file.isOpen() ? file.size() : ~0ULL)) * prime;
+        const char *data = file.data();
+        size_t i = 0;
+        for(; i + 8 <= file.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            hash = (hash ^ word) * prime;
+        }
+        for(; i < file.size(); i++) hash = (hash ^ (uint8_t)data[i]) * prime;
+    }
+    return hash;
+}
+
+bool SceneFile::compile(const std::string &path, const std::vector<std::string> &objPaths, float scale, int threads) {
+    TraceScope scope("scene compile");
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> texturePoints;
+    std::vector<glm::vec3> normals;
+    std::vector<SceneTriangle> triangles;
+    std::vector<SceneMaterial> materials;
+    std::vector<SceneTexture> textures;
+    std::vector<uint32_t> pixels;
+    std::vector<SceneString> sourceStrings;
+    std::vector<std::string> sources;
+    std::string strings;
+    auto addString = [&strings](const std::string &s) {
+        SceneString stored = {(uint32_t)strings.size(), (uint32_t)s.size()};
+        strings += s;
+        return stored;
+    };
+    auto addSource = [&sources](const std::string &s) {
+        if(std::find(sources.begin(), sources.end(), s) == sources.end()) sources.push_back(s);
+    };
+    //the OBJs come first, in order, so load() can check the scene was compiled from the same list
+    for(size_t o = 0; o < objPaths.size(); o++) sources.push_back(objPaths[o]);
+
+    for(size_t o = 0; o < objPaths.size(); o++) {
+        ObjMesh mesh;
+        if(!loadObjMesh(objPaths[o], mesh, threads)) return false;
+        for(size_t l = 0; l < mesh.libraries.size(); l++) addSource(mesh.libraries[l]);
+        uint32_t vertexBase = (uint32_t)vertices.size();
+        int32_t texturePointBase = (int32_t)texturePoints.size();
+        int32_t materialBase = (int32_t)materials.size();
+        for(size_t v = 0; v < mesh.vertices.size(); v++) vertices.push_back(scale * mesh.vertices[v]);
+        for(size_t t = 0; t < mesh.texturePoints.size(); t++) texturePoints.push_back(glm::vec2(mesh.texturePoints[t].x, mesh.texturePoints[t].y));
+
+        for(size_t m = 0; m < mesh.materials.size(); m++) {
+            const Material &source = mesh.materials[m];
+            SceneMaterial material;
+            material.colour[0] = source.colour.red;
+            material.colour[1] = source.colour.green;
+            material.colour[2] = source.colour.blue;
+            material.mirror = source.mirror;
+            material.name = addString(source.name);
+            material.texturePath = addString(source.texturePath);
+            material.texture = -1;
+            if(!source.texturePath.empty()) {
+                for(size_t t = 0; t < textures.size() && material.texture < 0; t++) {
+                    if(std::string(strings, textures[t].path.offset, textures[t].path.length) == source.texturePath) material.texture = (int32_t)t;
+                }
+                //textures that can't be read are left to be loaded (or not) at run time
+                if(material.texture < 0 && MappedFile(source.texturePath).size() > 0) {
+                    TextureMap map(source.texturePath);
+                    SceneTexture texture = {addString(source.texturePath), (uint32_t)map.width, (uint32_t)map.height, pixels.size()};
+                    pixels.insert(pixels.end(), map.pixels.begin(), map.pixels.end());
+                    material.texture = (int32_t)textures.size();
+                    textures.push_back(texture);
+                    addSource(source.texturePath);
+                }
+            }
+            materials.push_back(material);
+        }
+
+        for(size_t t = 0; t < mesh.triangles.size(); t++) {
+            const ObjTriangle &face = mesh.triangles[t];
+            SceneTriangle triangle;
+            for(int k = 0; k < 3; k++) {
+                triangle.vertices[k] = vertexBase + face.vertices[k];
+                triangle.texturePoints[k] = face.texturePoints[k] < 0 ? -1 : texturePointBase + face.texturePoints[k];
+            }
+            triangle.material = face.material < 0 ? -1 : materialBase + face.material;
+            triangles.push_back(triangle);
+            glm::vec3 e0 = vertices[triangle.vertices[1]] - vertices[triangle.vertices[0]];
+            glm::vec3 e1 = vertices[triangle.vertices[2]] - vertices[triangle.vertices[0]];
+            normals.push_back(glm::normalize(glm::cross(e0, e1)));
+        }
+    }
+    for(size_t s = 0; s < sources.size(); s++) sourceStrings.push_back(addString(sources[s]));
+
+    SceneHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SCENE_MAGIC, 4);
+    header.version = SCENE_VERSION;
+    header.hash = hashSources(sources, objPaths.size(), scale);
+    header.scale = scale;
+    header.sectionCount = SCENE_SECTIONS;
+    const void *data[SCENE_SECTIONS] = {vertices.data(), texturePoints.data(), normals.data(), triangles.data(),
+        materials.data(), textures.data(), pixels.data(), sourceStrings.data(), strings.data()};
+    size_t counts[SCENE_SECTIONS] = {vertices.size(), texturePoints.size(), normals.size(), triangles.size(),
+        materials.size(), textures.size(), pixels.size(), sourceStrings.size(), strings.size()};
+    uint64_t offset = sizeof(SceneHeader);
+    for(int s = 0; s < SCENE_SECTIONS; s++) {
+        offset = (offset + 7) & ~7ULL;
+        header.offsets[s] = offset;
+        header.counts[s] = counts[s];
+        offset += counts[s] * SECTION_SIZES[s];
+    }
+
+    //write to a temporary name first so a crash never leaves a half-written scene behind
+    std::string tempPath = path + ".tmp";
+    std::ofstream out(tempPath, std::ofstream::out | std::ofstream::binary);
+    out.write((const char *)&header, sizeof(header));
+    uint64_t written = sizeof(header);
+    static const char padding[8] = {0};
+    for(int s = 0; s < SCENE_SECTIONS; s++) {
+        out.write(padding, header.offsets[s] - written);
+        out.write((const char *)data[s], counts[s] * SECTION_SIZES[s]);
+        written = header.offsets[s] + counts[s] * SECTION_SIZES[s];
+    }
+    out.close();
+    if(!out) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return std::rename(tempPath.c_str(), path.c_str()) == 0;
+}
+
+bool SceneFile::load(const std::string &path, const std::vector<std::string> &objPaths, float scale) {
+    release();
+    std::unique_ptr<MappedFile> mapped(new MappedFile(path));
+    size_t size = mapped->size();
+    if(size < sizeof(SceneHeader)) return false;
+    const SceneHeader *header = (const SceneHeader *)mapped->data();
+    bool valid = std::memcmp(header->magic, SCENE_MAGIC, 4) == 0
+        && header->version == SCENE_VERSION
+        && header->sectionCount == SCENE_SECTIONS
+        && header->scale == scale;
+    for(int s = 0; valid && s < SCENE_SECTIONS; s++) {
+        valid = header->offsets[s] % 8 == 0 && header->offsets[s] <= size
+            && header->counts[s] <= (size - header->offsets[s]) / SECTION_SIZES[s];
+    }
+    if(!valid) return false;
+    file = std::move(mapped);
+    for(int s = 0; s < SCENE_SECTIONS; s++) {
+        sections[s] = file->data() + header->offsets[s];
+        counts[s] = header->counts[s];
+    }
+
+    //every index and string has to land inside its table before anything is handed out
+    const SceneTriangle *triangleTable = triangles();
+    for(size_t t = 0; valid && t < counts[SCENE_TRIANGLES]; t++) {
+        for(int k = 0; k < 3; k++) {
+            valid = valid && triangleTable[t].vertices[k] < counts[SCENE_VERTICES]
+                && triangleTable[t].texturePoints[k] < (int64_t)counts[SCENE_TEXTURE_POINTS];
+        }
+        valid = valid && triangleTable[t].material < (int64_t)counts[SCENE_MATERIALS];
+    }
+    valid = valid && counts[SCENE_NORMALS] == counts[SCENE_TRIANGLES];
+    auto validString = [this](SceneString s) { return (uint64_t)s.offset + s.length <= counts[SCENE_STRINGS]; };
+    const SceneMaterial *materialTable = (const SceneMaterial *)sections[SCENE_MATERIALS];
+    for(size_t m = 0; valid && m < counts[SCENE_MATERIALS]; m++) {
+        valid = validString(materialTable[m].name) && validString(materialTable[m].texturePath)
+            && materialTable[m].texture < (int64_t)counts[SCENE_TEXTURES];
+    }
+    const SceneTexture *textureTable = (const SceneTexture *)sections[SCENE_TEXTURES];
+    for(size_t t = 0; valid && t < counts[SCENE_TEXTURES]; t++) {
+        valid = validString(textureTable[t].path) && textureTable[t].pixels <= counts[SCENE_PIXELS]
+            && (uint64_t)textureTable[t].width * textureTable[t].height <= counts[SCENE_PIXELS] - textureTable[t].pixels;
+    }
+    const SceneString *sourceTable = (const SceneString *)sections[SCENE_SOURCES];
+    std::vector<std::string> sources;
+    for(size_t s = 0; valid && s < counts[SCENE_SOURCES]; s++) {
+        valid = validString(sourceTable[s]);
+        if(valid) sources.push_back(string(sourceTable[s]));
+    }
+    valid = valid && sources.size() >= objPaths.size() && std::equal(objPaths.begin(), objPaths.end(), sources.begin())
+        && hashSources(sources, objPaths.size(), scale) == header->hash;
+    if(!valid) release();
+    return valid;
+}
+
+size_t SceneFile::triangleCount() const {
+    return counts[SCENE_TRIANGLES];
+}
+
+const SceneTriangle *SceneFile::triangles() const {
+    return (const SceneTriangle *)sections[SCENE_TRIANGLES];
+}
+
+const glm::vec3 *SceneFile::vertices() const {
+    return (const glm::vec3 *)sections[SCENE_VERTICES];
+}
+
+const glm::vec2 *SceneFile::texturePoints() const {
+    return (const glm::vec2 *)sections[SCENE_TEXTURE_POINTS];
+}
+
+const glm::vec3 *SceneFile::normals() const {
+    return (const glm::vec3 *)sections[SCENE_NORMALS];
+}
+
+size_t SceneFile::materialCount() const {
+    return counts[SCENE_MATERIALS];
+}
+
+Material SceneFile::material(size_t index) const {
+    const SceneMaterial &stored = ((const SceneMaterial *)sections[SCENE_MATERIALS])[index];
+    Material material(Colour(stored.colour[0], stored.colour[1], stored.colour[2]), string(stored.texturePath), string(stored.name));
+    material.mirror = stored.mirror != 0;
+    return material;
+}
+
+size_t SceneFile::textureCount() const {
+    return counts[SCENE_TEXTURES];
+}
+
+std::string SceneFile::texturePath(size_t index) const {
+    return string(((const SceneTexture *)sections[SCENE_TEXTURES])[index].path);
+}
+
+TextureMap SceneFile::texture(size_t index) const {
+    const SceneTexture &stored = ((const SceneTexture *)sections[SCENE_TEXTURES])[index];
+    const uint32_t *pixels = (const uint32_t *)sections[SCENE_PIXELS] + stored.pixels;
+    TextureMap map;
+    map.width = stored.width;
+    map.height = stored.height;
+    map.pixels.assign(pixels, pixels + (size_t)stored.width * stored.height);
+    return map;
+}
+
+std::string SceneFile::string(SceneString s) const {
+    return std::string(sections[SCENE_STRINGS] + s.offset, s.length);
+}
+
+void SceneFile::release() {
+    file.reset();
+    for(int s = 0; s < SCENE_SECTIONS; s++) {
+        sections[s] = NULL;
+        counts[s] = 0;
+    }
+}
+
+SceneFile::SceneFile() {
+    release();
+}
+
+SceneFile::~SceneFile() = default;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Material.h"
+#include "TextureMap.h"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+
+class MappedFile;
+
+//A triangle of a compiled scene: indices into the vertex and texture point tables (-1 for no texture point)
+//and the material table (-1 for the default material). Its face normal is the same index in the normal table.
+struct SceneTriangle {
+    uint32_t vertices[3];
+    int32_t texturePoints[3];
+    int32_t material;
+};
+
+//A string stored in the scene's string table
+struct SceneString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct SceneMaterial {
+    int32_t colour[3];
+    int32_t mirror;
+    SceneString name;
+    SceneString texturePath;
+    //index into the texture table, -1 if untextured
+    int32_t texture;
+};
+
+//Pixels are ARGB, like TextureMap, starting at pixel index `pixels` of the pixel table
+struct SceneTexture {
+    SceneString path;
+    uint32_t width;
+    uint32_t height;
+    uint64_t pixels;
+};
+
+enum SceneSection {
+    SCENE_VERTICES,
+    SCENE_TEXTURE_POINTS,
+    SCENE_NORMALS,
+    SCENE_TRIANGLES,
+    SCENE_MATERIALS,
+    SCENE_TEXTURES,
+    SCENE_PIXELS,
+    SCENE_SOURCES,
+    SCENE_STRINGS,
+    SCENE_SECTIONS
+};
+
+//One or more OBJ files merged, scaled and with face normals worked out ahead of time, in a single file that is
+//mapped straight in. Alongside the tables it keeps every file it was compiled from (OBJs, MTLs and textures,
+//which are embedded) and a hash of their contents, so a stale scene is noticed and recompiled.
+class SceneFile {
+public:
+    //Parse objPaths (on up to `threads` threads), scale them and write the compiled scene to path.
+    //False if a source or the output fails.
+    static bool compile(const std::string &path, const std::vector<std::string> &objPaths, float scale, int threads = 1);
+
+    //Map a compiled scene in. Refuses (and leaves the scene empty) if the file is missing or malformed, or wasn't
+    //compiled from exactly objPaths at this scale, or any of its sources have changed since.
+    bool load(const std::string &path, const std::vector<std::string> &objPaths, float scale);
+
+    size_t triangleCount() const;
+    const SceneTriangle *triangles() const;
+    const glm::vec3 *vertices() const;
+    const glm::vec2 *texturePoints() const;
+    const glm::vec3 *normals() const;
+    size_t materialCount() const;
+    Material material(size_t index) const;
+    size_t textureCount() const;
+    std::string texturePath(size_t index) const;
+    TextureMap texture(size_t index) const;
+
+    SceneFile();
+    SceneFile(const SceneFile &) = delete;
+    SceneFile &operator=(const SceneFile &) = delete;
+    ~SceneFile();
+private:
+    std::unique_ptr<MappedFile> file;
+    const char *sections[SCENE_SECTIONS];
+    uint64_t counts[SCENE_SECTIONS];
+
+    std::string string(SceneString s) const;
+    void release();
+};
@@ -0,0 +1,21 @@
+#include "Sobol.h"
+
+Sobol::Sobol(uint32_t scrambleX, uint32_t scrambleY) : scrambleX(scrambleX), scrambleY(scrambleY) {}
+
+void Sobol::sample(uint32_t index, float &x, float &y) const {
+    //dimension 0 is the van der Corput sequence (direction numbers 1 << (31 - bit)),
+    //dimension 1 comes from the primitive polynomial x + 1 (each direction number is v ^ (v >> 1) of the last)
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t v = 1u << 31;
+    for(int bit = 0; index != 0; bit++, index >>= 1) {
+        if(index & 1) {
+            a ^= 1u << (31 - bit);
+            b ^= v;
+        }
+        v ^= v >> 1;
+    }
+    //top 24 bits so the result is exactly representable and never rounds up to 1
+    x = ((a ^ scrambleX) >> 8) * (1.0f / 16777216.0f);
+    y = ((b ^ scrambleY) >> 8) * (1.0f / 16777216.0f);
+}
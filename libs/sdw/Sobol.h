@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+
+//First two dimensions of the Sobol sequence, randomised by a digital shift (xor with a fixed scramble).
+//Any prefix of the points is well stratified over the unit square, and point i depends only on i,
+//so work items can still be handed out to threads by index.
+class Sobol {
+public:
+    Sobol(uint32_t scrambleX, uint32_t scrambleY);
+    //Point index in [0, 1)^2
+    void sample(uint32_t index, float &x, float &y) const;
+private:
+    uint32_t scrambleX;
+    uint32_t scrambleY;
+};
@@ -1,32 +1,96 @@
 #include "TextureMap.h"
+#include "MappedFile.h"
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
 
-TextureMap::TextureMap() = default;
-TextureMap::TextureMap(const std::string &filename) {
-	std::ifstream inputStream(filename, std::ifstream::in);
-	std::string nextLine;
-	// Get the "P6" magic number
-	std::getline(inputStream, nextLine);
-	// Read the width and height line
-	std::getline(inputStream, nextLine);
-	// Skip over any comment lines !
-	while (nextLine.at(0) == '#') std::getline(inputStream, nextLine);
-	auto widthAndHeight = split(nextLine, ' ');
-	if (widthAndHeight.size() != 2)
-		throw std::invalid_argument("Failed to parse width and height line, line was `" + nextLine + "`");
+//Next header number, skipping whitespace and # comments; throws if there isn't one
+static size_t headerNumber(const char *&p, const char *end, const std::string &filename) {
+	while (p < end && (std::isspace((unsigned char)*p) || *p == '#')) {
+		if (*p == '#') while (p < end && *p != '\n') p++;
+		else p++;
+	}
+	if (p >= end || !std::isdigit((unsigned char)*p))
+		throw std::invalid_argument("Failed to parse PPM header of `" + filename + "`");
+	size_t value = 0;
+	while (p < end && std::isdigit((unsigned char)*p) && value < 100000000) value = value * 10 + (*p++ - '0');
+	return value;
+}
 
-	width = std::stoi(widthAndHeight[0]);
-	height = std::stoi(widthAndHeight[1]);
-	// Read the max value (which we assume is 255)
-	std::getline(inputStream, nextLine);
+//RGB triplets to opaque ARGB, 4 pixels (12 bytes in, 16 out) per step where SSSE3 is available
+static void rgbToArgb(const uint8_t *rgb, uint32_t *argb, size_t count) {
+	size_t i = 0;
+#if defined(__SSSE3__)
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	//each load reads 16 bytes but only uses 12, so stop while a whole load still fits
+	for (; i + 6 <= count; i += 4) {
+		__m128i source = _mm_loadu_si128((const __m128i *)(rgb + i * 3));
+		_mm_storeu_si128((__m128i *)(argb + i), _mm_or_si128(_mm_shuffle_epi8(source, shuffle), alpha));
+	}
+#endif
+	for (; i < count; i++) {
+		const uint8_t *p = rgb + i * 3;
+		argb[i] = (255u << 24) | ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+	}
+}
 
+void TextureMap::unpack() {
+	if (rgb.empty()) return;
 	pixels.resize(width * height);
-	for (size_t i = 0; i < width * height; i++) {
-		int red = inputStream.get();
-		int green = inputStream.get();
-		int blue = inputStream.get();
-		pixels[i] = ((255 << 24) + (red << 16) + (green << 8) + (blue));
+	rgbToArgb(rgb.data(), pixels.data(), pixels.size());
+	std::vector<uint8_t>().swap(rgb);
+}
+
+TextureMap::TextureMap() = default;
+TextureMap::TextureMap(const std::string &filename, bool compact) {
+	MappedFile file(filename);
+	if (!file.isOpen()) throw std::invalid_argument("Failed to open `" + filename + "`");
+	const char *p = file.data();
+	const char *end = p + file.size();
+	if (file.size() < 2 || p[0] != 'P' || (p[1] != '6' && p[1] != '3'))
+		throw std::invalid_argument("`" + filename + "` is not a P6 or P3 PPM file");
+	bool binary = p[1] == '6';
+	p += 2;
+	width = headerNumber(p, end, filename);
+	height = headerNumber(p, end, filename);
+	size_t maxval = headerNumber(p, end, filename);
+	if (maxval == 0 || maxval > 65535) throw std::invalid_argument("Bad maxval in `" + filename + "`");
+	//exactly one whitespace character separates the header from binary data
+	if (p >= end) throw std::invalid_argument("`" + filename + "` is truncated");
+	p++;
+
+	size_t samples = width * height * 3;
+	if (binary && maxval == 255) {
+		//the common case goes straight from the mapped file to its final form
+		if ((size_t)(end - p) < samples) throw std::invalid_argument("`" + filename + "` is truncated");
+		if (compact) rgb.assign((const uint8_t *)p, (const uint8_t *)p + samples);
+		else {
+			pixels.resize(width * height);
+			rgbToArgb((const uint8_t *)p, pixels.data(), pixels.size());
+		}
+		return;
+	}
+	rgb.resize(samples);
+	if (binary) {
+		int bytes = maxval < 256 ? 1 : 2;
+		if ((size_t)(end - p) < samples * bytes) throw std::invalid_argument("`" + filename + "` is truncated");
+		const uint8_t *data = (const uint8_t *)p;
+		for (size_t i = 0; i < samples; i++) {
+			//16 bit samples are big-endian
+			size_t sample = bytes == 1 ? data[i] : ((size_t)data[i * 2] << 8) | data[i * 2 + 1];
+			rgb[i] = (uint8_t)((std::min(sample, maxval) * 255 + maxval / 2) / maxval);
+		}
+	} else {
+		for (size_t i = 0; i < samples; i++) {
+			size_t sample = headerNumber(p, end, filename);
+			rgb[i] = (uint8_t)((std::min(sample, maxval) * 255 + maxval / 2) / maxval);
+		}
 	}
-	inputStream.close();
+	if (!compact) unpack();
 }
 
 std::ostream &operator<<(std::ostream &os, const TextureMap &map) {
@@ -3,15 +3,25 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <vector>
+#include <cstdint>
 #include "Utils.h"
 
 class TextureMap {
 public:
 	size_t width;
 	size_t height;
+	//ARGB, row by row. Empty while a compact texture is still packed (see unpack())
 	std::vector<uint32_t> pixels;
+	//8 bit RGB triplets of a compact texture that hasn't been unpacked yet
+	std::vector<uint8_t> rgb;
+
+	//Expand rgb into pixels, if that hasn't happened yet
+	void unpack();
 
 	TextureMap();
-	TextureMap(const std::string &filename);
+	//Reads binary (P6) or ASCII (P3) PPM files with any maxval up to 65535, scaling samples to 8 bits.
+	//With compact set, the pixels stay as 3 byte RGB until unpack() is called.
+	TextureMap(const std::string &filename, bool compact = false);
 	friend std::ostream &operator<<(std::ostream &os, const TextureMap &point);
 };
@@ -0,0 +1,51 @@
+#include "TinyFont.h"
+#include <cctype>
+
+namespace {
+struct Glyph {
+    char c;
+    //5 rows of 3, top left first
+    const char *bits;
+};
+
+const Glyph glyphs[] = {
+    {'0', "111101101101111"}, {'1', "010110010010111"}, {'2', "111001111100111"}, {'3', "111001111001111"},
+    {'4', "101101111001001"}, {'5', "111100111001111"}, {'6', "111100111101111"}, {'7', "111001001001001"},
+    {'8', "111101111101111"}, {'9', "111101111001111"}, {'.', "000000000000010"}, {'-', "000000111000000"},
+    {'A', "010101111101101"}, {'B', "110101110101110"}, {'C', "011100100100011"}, {'D', "110101101101110"},
+    {'E', "111100110100111"}, {'F', "111100110100100"}, {'G', "011100101101011"}, {'H', "101101111101101"},
+    {'I', "111010010010111"}, {'J', "001001001101010"}, {'K', "101101110101101"}, {'L', "100100100100111"},
+    {'M', "101111111101101"}, {'N', "110101101101101"}, {'O', "010101101101010"}, {'P', "110101110100100"},
+    {'Q', "010101101110011"}, {'R', "110101110101101"}, {'S', "011100010001110"}, {'T', "111010010010010"},
+    {'U', "101101101101111"}, {'V', "101101101101010"}, {'W', "101101111111101"}, {'X', "101101010101101"},
+    {'Y', "101101010010010"}, {'Z', "111001010100111"}, {' ', "000000000000000"}
+};
+
+const char *glyphBits(char c) {
+    c = (char)std::toupper((unsigned char)c);
+    for(size_t i = 0; i < sizeof(glyphs) / sizeof(glyphs[0]); i++) if(glyphs[i].c == c) return glyphs[i].bits;
+    //a solid block, so a missing glyph shows rather than reading as a space
+    return "111111111111111";
+}
+}
+
+void drawText(DrawingWindow &window, int x, int y, const std::string &text, uint32_t colour, int scale) {
+    for(size_t i = 0; i < text.size(); i++) {
+        const char *bits = glyphBits(text[i]);
+        int left = x + (int)i * textAdvance(scale);
+        for(int b = 0; b < 15; b++) {
+            if(bits[b] != '1') continue;
+            for(int px = 0; px < scale; px++) {
+                for(int py = 0; py < scale; py++) {
+                    int sx = left + (b % 3) * scale + px;
+                    int sy = y + (b / 3) * scale + py;
+                    if(sx >= 0 && sy >= 0 && sx < (int)window.width && sy < (int)window.height) window.setPixelColour(sx, sy, colour);
+                }
+            }
+        }
+    }
+}
+
+int textAdvance(int scale) {
+    return 4 * scale;
+}
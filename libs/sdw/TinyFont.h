@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include "DrawingWindow.h"
+
+//Draw text in a 3x5 pixel font, each font pixel scale x scale on screen, from (x, y) at the top left. Digits,
+//'.', '-', space and A-Z (lower case is drawn as upper); anything else is drawn as a solid block.
+void drawText(DrawingWindow &window, int x, int y, const std::string &text, uint32_t colour, int scale);
+//Width on screen of one character, including the gap after it
+int textAdvance(int scale);
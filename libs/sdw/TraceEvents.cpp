@@ -0,0 +1,129 @@
+#include "TraceEvents.h"
+#include "FrameWriter.h"
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#define TRACE_CHUNK 16384
+//per thread; later events are dropped
+#define TRACE_MAX_CHUNKS 1024
+
+std::atomic<bool> tracingEnabled(false);
+
+namespace {
+struct TraceEvent {
+    const char *name;
+    int64_t nanoseconds;
+    char phase;
+};
+
+//Written only by the thread holding it. Chunks are allocated as needed and never move, and count is stored after the
+//event it covers, so a reader sees whole events up to count.
+struct ThreadTrace {
+    int id;
+    std::atomic<const char *> name;
+    std::atomic<TraceEvent *> chunks[TRACE_MAX_CHUNKS];
+    std::atomic<size_t> count;
+};
+
+std::chrono::steady_clock::time_point traceStart;
+//kept past their threads' exit so what they recorded can still be written
+std::mutex registryMutex;
+std::vector<ThreadTrace *> registry;
+//buffers whose threads have exited, handed on to the next new thread
+std::vector<ThreadTrace *> unused;
+
+//Gives the thread's buffer back when the thread exits, so short-lived workers carry on in a few buffers (and
+//tids) rather than each leaving one behind
+struct LocalTrace {
+    ThreadTrace *trace = nullptr;
+    ~LocalTrace() {
+        if(trace == nullptr) return;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        unused.push_back(trace);
+    }
+};
+thread_local LocalTrace local;
+
+ThreadTrace *threadTrace() {
+    if(local.trace != nullptr) return local.trace;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if(!unused.empty()) {
+        local.trace = unused.back();
+        unused.pop_back();
+        return local.trace;
+    }
+    ThreadTrace *trace = new ThreadTrace();
+    trace->name = nullptr;
+    for(int c = 0; c < TRACE_MAX_CHUNKS; c++) trace->chunks[c] = nullptr;
+    trace->count = 0;
+    trace->id = (int)registry.size() + 1;
+    registry.push_back(trace);
+    local.trace = trace;
+    return trace;
+}
+
+void record(const char *name, char phase) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStart).count();
+    ThreadTrace *trace = threadTrace();
+    size_t index = trace->count.load(std::memory_order_relaxed);
+    size_t chunk = index / TRACE_CHUNK;
+    if(chunk >= TRACE_MAX_CHUNKS) return;
+    TraceEvent *events = trace->chunks[chunk].load(std::memory_order_relaxed);
+    if(events == nullptr) {
+        events = new TraceEvent[TRACE_CHUNK];
+        trace->chunks[chunk].store(events, std::memory_order_release);
+    }
+    events[index % TRACE_CHUNK] = TraceEvent{name, now, phase};
+    trace->count.store(index + 1, std::memory_order_release);
+}
+}
+
+void startTracing() {
+    traceStart = std::chrono::steady_clock::now();
+    tracingEnabled = true;
+}
+
+void traceBegin(const char *name) {
+    if(tracingEnabled.load(std::memory_order_relaxed)) record(name, 'B');
+}
+
+void traceEnd(const char *name) {
+    if(tracingEnabled.load(std::memory_order_relaxed)) record(name, 'E');
+}
+
+void nameTraceThread(const char *name) {
+    if(tracingEnabled.load(std::memory_order_relaxed)) threadTrace()->name = name;
+}
+
+bool writeTrace(const std::string &path) {
+    std::vector<ThreadTrace *> threads;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threads = registry;
+    }
+    std::string json = "{\"traceEvents\":[\n";
+    bool first = true;
+    char line[256];
+    for(size_t t = 0; t < threads.size(); t++) {
+        ThreadTrace *trace = threads[t];
+        const char *name = trace->name.load();
+        if(name != nullptr) {
+            std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", trace->id, name);
+            json += line;
+            first = false;
+        }
+        size_t count = trace->count.load(std::memory_order_acquire);
+        for(size_t i = 0; i < count; i++) {
+            const TraceEvent &event = trace->chunks[i / TRACE_CHUNK].load(std::memory_order_acquire)[i % TRACE_CHUNK];
+            std::snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}",
+                first ? "" : ",\n", event.name, event.phase, event.nanoseconds / 1000.0, trace->id);
+            json += line;
+            first = false;
+        }
+    }
+    json += "\n]}\n";
+    return writeFile(path, (const uint8_t *)json.data(), json.size());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+//Chrome trace-event recording: open what writeTrace() produces in chrome://tracing or Perfetto. Each thread
+//appends begin/end events to its own buffer without locking, and writeTrace() reads every thread's buffer as it
+//stands; once a thread exits, its buffer and tid pass to the next new thread. Until startTracing() nothing is
+//recorded and a TraceScope costs one relaxed load. Names aren't copied, so they have to be string literals.
+extern std::atomic<bool> tracingEnabled;
+
+void startTracing();
+//Both do nothing until startTracing()
+void traceBegin(const char *name);
+void traceEnd(const char *name);
+//Label the calling thread in the trace
+void nameTraceThread(const char *name);
+//False if the file can't be written
+bool writeTrace(const std::string &path);
+
+//A begin event now and the matching end when it goes out of scope
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name(tracingEnabled.load(std::memory_order_relaxed) ? name : nullptr) {
+        if(this->name) traceBegin(this->name);
+    }
+    ~TraceScope() {
+        if(name) traceEnd(name);
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+private:
+    const char *name;
+};
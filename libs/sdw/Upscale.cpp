@@ -0,0 +1,45 @@
+#include "Upscale.h"
+#include <vector>
+
+namespace {
+//Source index and 8-bit weight of the next pixel along, for each destination pixel along one axis
+void sampleAxis(int srcSize, int dstSize, std::vector<int> &index, std::vector<int> &weight) {
+    index.resize(dstSize);
+    weight.resize(dstSize);
+    for(int d = 0; d < dstSize; d++) {
+        float s = (d + 0.5f) * srcSize / dstSize - 0.5f;
+        if(s < 0) s = 0;
+        int i = (int)s;
+        if(i >= srcSize - 1) {
+            index[d] = srcSize - 1;
+            weight[d] = 0;
+        } else {
+            index[d] = i;
+            weight[d] = (int)((s - i) * 256);
+        }
+    }
+}
+
+//(a * (256 - w) + b * w) / 256 for all four channels at once, two at a time in 16-bit lanes
+inline uint32_t blend(uint32_t a, uint32_t b, int w) {
+    uint32_t rb = ((a & 0x00FF00FF) * (256 - w) + (b & 0x00FF00FF) * w) >> 8;
+    uint32_t ag = ((a >> 8) & 0x00FF00FF) * (256 - w) + ((b >> 8) & 0x00FF00FF) * w;
+    return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+}
+
+void upscaleBilinear(const uint32_t *src, int srcWidth, int srcHeight, uint32_t *dst, int dstWidth, int dstHeight) {
+    std::vector<int> xs, xw, ys, yw;
+    sampleAxis(srcWidth, dstWidth, xs, xw);
+    sampleAxis(srcHeight, dstHeight, ys, yw);
+    for(int y = 0; y < dstHeight; y++) {
+        const uint32_t *row0 = src + ys[y] * srcWidth;
+        const uint32_t *row1 = yw[y] ? row0 + srcWidth : row0;
+        for(int x = 0; x < dstWidth; x++) {
+            int x1 = xw[x] ? xs[x] + 1 : xs[x];
+            uint32_t top = blend(row0[xs[x]], row0[x1], xw[x]);
+            uint32_t bottom = blend(row1[xs[x]], row1[x1], xw[x]);
+            dst[y * dstWidth + x] = blend(top, bottom, yw[y]);
+        }
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+//Scale an ARGB image up (or down) to dstWidth x dstHeight, blending the four source pixels nearest each
+//destination pixel's centre. Edges are clamped.
+void upscaleBilinear(const uint32_t *src, int srcWidth, int srcHeight, uint32_t *dst, int dstWidth, int dstHeight);
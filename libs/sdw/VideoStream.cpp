@@ -0,0 +1,152 @@
+#include "VideoStream.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//Integer BT.601 for 8-bit limited range, as used by most encoders
+static inline uint8_t lumaOf(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t blueDifference(int r, int g, int b) {
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t redDifference(int r, int g, int b) {
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+#if defined(__SSE2__)
+//Split 8 ARGB pixels into 16-bit r, g, b lanes
+static inline void unpackChannels(const uint32_t *argb, __m128i &r, __m128i &g, __m128i &b) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i low = _mm_loadu_si128((const __m128i *)argb);
+    __m128i high = _mm_loadu_si128((const __m128i *)(argb + 4));
+    r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(low, 16), mask), _mm_and_si128(_mm_srli_epi32(high, 16), mask));
+    g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(low, 8), mask), _mm_and_si128(_mm_srli_epi32(high, 8), mask));
+    b = _mm_packs_epi32(_mm_and_si128(low, mask), _mm_and_si128(high, mask));
+}
+
+//Sum neighbouring lanes of the two rows and average, giving 4 values in the low 4 lanes
+static inline __m128i blockAverage(__m128i top, __m128i bottom) {
+    __m128i sums = _mm_madd_epi16(_mm_add_epi16(top, bottom), _mm_set1_epi16(1));
+    sums = _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(2)), 2);
+    return _mm_packs_epi32(sums, sums);
+}
+
+static inline __m128i chroma(__m128i r, __m128i g, __m128i b, short kr, short kg, short kb) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)), _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+    sum = _mm_add_epi16(sum, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+    sum = _mm_srai_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(sum, _mm_set1_epi16(128));
+}
+#endif
+
+void argbToYuv420(const uint32_t *argb, size_t width, size_t height, uint8_t *y, uint8_t *u, uint8_t *v) {
+    size_t chromaWidth = (width + 1) / 2;
+    for(size_t row = 0; row < height; row += 2) {
+        const uint32_t *top = argb + row * width;
+        //odd heights repeat the last row for the final chroma line
+        const uint32_t *bottom = row + 1 < height ? top + width : top;
+        uint8_t *yTop = y + row * width;
+        uint8_t *yBottom = row + 1 < height ? yTop + width : NULL;
+        uint8_t *uRow = u + (row / 2) * chromaWidth;
+        uint8_t *vRow = v + (row / 2) * chromaWidth;
+        size_t x = 0;
+#if defined(__SSE2__)
+        //every sum below stays within 16 bits (unsigned for luma, signed for chroma)
+        const __m128i lumaR = _mm_set1_epi16(66), lumaG = _mm_set1_epi16(129), lumaB = _mm_set1_epi16(25);
+        for(; x + 8 <= width; x += 8) {
+            __m128i r0, g0, b0, r1, g1, b1;
+            unpackChannels(top + x, r0, g0, b0);
+            unpackChannels(bottom + x, r1, g1, b1);
+            __m128i l0 = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r0, lumaR), _mm_mullo_epi16(g0, lumaG)), _mm_mullo_epi16(b0, lumaB));
+            l0 = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(l0, _mm_set1_epi16(128)), 8), _mm_set1_epi16(16));
+            _mm_storel_epi64((__m128i *)(yTop + x), _mm_packus_epi16(l0, l0));
+            if(yBottom) {
+                __m128i l1 = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r1, lumaR), _mm_mullo_epi16(g1, lumaG)), _mm_mullo_epi16(b1, lumaB));
+                l1 = _mm_add_epi16(_mm_srli_epi16(_mm_add_epi16(l1, _mm_set1_epi16(128)), 8), _mm_set1_epi16(16));
+                _mm_storel_epi64((__m128i *)(yBottom + x), _mm_packus_epi16(l1, l1));
+            }
+            __m128i r = blockAverage(r0, r1), g = blockAverage(g0, g1), b = blockAverage(b0, b1);
+            __m128i cb = chroma(r, g, b, -38, -74, 112), cr = chroma(r, g, b, 112, -94, -18);
+            int cbBytes = _mm_cvtsi128_si32(_mm_packus_epi16(cb, cb));
+            int crBytes = _mm_cvtsi128_si32(_mm_packus_epi16(cr, cr));
+            std::memcpy(uRow + x / 2, &cbBytes, 4);
+            std::memcpy(vRow + x / 2, &crBytes, 4);
+        }
+#endif
+        for(; x < width; x += 2) {
+            //odd widths repeat the last column for the final chroma sample
+            size_t right = x + 1 < width ? x + 1 : x;
+            const uint32_t corners[4] = {top[x], top[right], bottom[x], bottom[right]};
+            int r = 0, g = 0, b = 0;
+            for(int c = 0; c < 4; c++) {
+                r += (corners[c] >> 16) & 0xFF;
+                g += (corners[c] >> 8) & 0xFF;
+                b += corners[c] & 0xFF;
+            }
+            for(size_t column = x; column <= right; column++) {
+                yTop[column] = lumaOf((top[column] >> 16) & 0xFF, (top[column] >> 8) & 0xFF, top[column] & 0xFF);
+                if(yBottom) yBottom[column] = lumaOf((bottom[column] >> 16) & 0xFF, (bottom[column] >> 8) & 0xFF, bottom[column] & 0xFF);
+            }
+            r = (r + 2) >> 2;
+            g = (g + 2) >> 2;
+            b = (b + 2) >> 2;
+            uRow[x / 2] = blueDifference(r, g, b);
+            vRow[x / 2] = redDifference(r, g, b);
+        }
+    }
+}
+
+bool VideoSink::isOpen() const {
+    return fd >= 0;
+}
+
+size_t VideoSink::write(const uint32_t *pixels, size_t width, size_t height, const std::string &, std::vector<uint8_t> &buffer) {
+    if(fd < 0) return 0;
+    size_t length = 0;
+    //the frame (with its Y4M frame header) is built in buffer to go out in a single write
+    if(format == Y4M) {
+        size_t lumaSize = width * height;
+        size_t chromaSize = ((width + 1) / 2) * ((height + 1) / 2);
+        char header[128];
+        //the stream header goes out with the first frame, once the size is known
+        int headerLength = headerWritten ? 0 : std::snprintf(header, sizeof(header), "YUV4MPEG2 W%zu H%zu F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+        headerLength += std::snprintf(header + headerLength, sizeof(header) - headerLength, "FRAME\n");
+        length = headerLength + lumaSize + 2 * chromaSize;
+        buffer.resize(length);
+        std::memcpy(buffer.data(), header, headerLength);
+        uint8_t *luma = buffer.data() + headerLength;
+        argbToYuv420(pixels, width, height, luma, luma + lumaSize, luma + lumaSize + chromaSize);
+    } else {
+        length = width * height * 3;
+        buffer.resize(length);
+        argbToRgb(pixels, buffer.data(), width * height);
+    }
+    headerWritten = true;
+    size_t done = 0;
+    while(done < length) {
+        ssize_t result = ::write(fd, buffer.data() + done, length - done);
+        if(result <= 0) return 0;
+        done += (size_t)result;
+    }
+    return length;
+}
+
+VideoSink::VideoSink(const std::string &path, VideoFormat format, int fps) : fd(-1), format(format), fps(fps), headerWritten(false) {
+    if(path == "-") {
+        //keep the real stdout for the video and send everything else written to it to stderr
+        std::fflush(stdout);
+        fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+}
+
+VideoSink::~VideoSink() {
+    if(fd >= 0) close(fd);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "FrameWriter.h"
+
+enum VideoFormat { Y4M, RAW_RGB };
+
+//ARGB to planar YUV 4:2:0 (BT.601 limited range, chroma averaged over each 2x2 block). y is width x height,
+//u and v are ((width + 1) / 2) x ((height + 1) / 2).
+void argbToYuv420(const uint32_t *argb, size_t width, size_t height, uint8_t *y, uint8_t *u, uint8_t *v);
+
+//Appends every frame to one stream: a YUV4MPEG2 file, or bare packed RGB frames. A path of "-" streams to
+//stdout for piping into an encoder, e.g. `CG2020 --video - | ffmpeg -i - out.mp4`; anything else the program
+//prints is moved to stderr so it can't end up in the video.
+class VideoSink : public FrameSink {
+public:
+    bool isOpen() const;
+    //The per-frame path is ignored: every frame goes to the stream opened by the constructor
+    size_t write(const uint32_t *pixels, size_t width, size_t height, const std::string &path, std::vector<uint8_t> &scratch);
+    bool ordered() const { return true; }
+
+    VideoSink(const std::string &path, VideoFormat format, int fps);
+    VideoSink(const VideoSink &) = delete;
+    VideoSink &operator=(const VideoSink &) = delete;
+    ~VideoSink();
+private:
+    int fd;
+    VideoFormat format;
+    int fps;
+    bool headerWritten;
+};
@@ -16,17 +16,111 @@
 #include "RayTriangleIntersection.h"
 #include <glm/gtx/string_cast.hpp>
 #include "KDTree.h"
+#include "IrradianceCache.h"
+#include "PhotonGrid.h"
+#include "PCG32.h"
+#include "ObjLoader.h"
+#include "SceneFile.h"
+#include <unordered_map>
+#include "Sobol.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include "FrameWriter.h"
+#include "VideoStream.h"
+#include "ImageEncoder.h"
+#include "DirtyTiles.h"
+#include "SPSCQueue.h"
+#include "Upscale.h"
+#include "FrameProfile.h"
+#include "TinyFont.h"
+#include "TraceEvents.h"
 
 #define WIDTH 800
 #define HEIGHT 600
+#define PHOTON_RADIUS 0.05f
+#define MAX_GATHER 500
+#define MAX_BOUNCES 16
+#define PHOTON_COUNT 1000000
+#define CAUSTIC_COUNT 100000
+#define PROGRESSIVE_FIRST 50000
+#define PHOTON_SNAPSHOT "photonmap.bin"
+#define CAUSTIC_SNAPSHOT "causticmap.bin"
+#define CAUSTIC_RADIUS 0.02f
+#define CAUSTIC_EXPOSURE 2.0f
+#define PROJECTION_RES 64
+#define IRRADIANCE_STRIDE 16
+#define SPPM_PHOTONS 100000
+#define SPPM_RADIUS 0.05f
+#define SPPM_ALPHA 0.7f
+#define SPPM_EXPOSURE 4.0f
+#define SCENE_CACHE "scene.bin"
+#define IDLE_WAIT_MS 50
+#define TILE_SIZE 32
+#define PRESENT_HZ 60
+#define TRACE_SLICE_MS 30
+#define COARSEST_BLOCK 8
+#define MAX_RENDER_SCALE 8
+#define SPPM_BATCHES 40
+#define CAMERA_SETTLE_MS 250
 
 std::vector<std::vector<float>> ZBuffer;
 std::vector<std::pair<ModelTriangle, Material>> pairs;
 bool orbitMode = false;
-bool photonsExist = false;
-KDTree PHOTONMAP;
+//Textures by path, read the first time they're drawn unless the compiled scene already supplied them
+std::unordered_map<std::string, TextureMap> textures;
+
+//Everything the ray tracer gathers photons from. The builder thread publishes a whole new set at a time
+//through photonMaps (with std::atomic_load/atomic_store) while frames keep rendering from the previous one.
+struct PhotonMaps {
+	KDTree global;
+	KDTree caustic;
+	//caustic photons carry flux as a fraction of the light's output, so estimates divide by photons emitted
+	int causticEmitted = 0;
+	//What photonIntensity() gathers from: the KD-trees, or hashed grids built from them with --photon-grid
+	PhotonGrid globalGrid;
+	PhotonGrid causticGrid;
+	const PhotonLookup *globalPhotons = NULL;
+	const PhotonLookup *causticPhotons = NULL;
+	IrradianceCache irradiance;
+	bool irradianceExists = false;
+};
+
+std::shared_ptr<const PhotonMaps> photonMaps;
+//Bumped after each set of maps is published, so a ray-traced frame can tell it was drawn from older ones
+std::atomic<int> photonMapsPublished(0);
+bool photonGrid = false;
+std::atomic<bool> irradianceMode(false);
+//Bumped (under photonMutex) whenever the light moves or the scene is recoloured; the builder drops any map built
+//for an older version
+std::atomic<int> photonVersion(0);
+std::mutex photonMutex;
+std::condition_variable photonWake;
+//Started with the first ray-traced frame, stopped and joined at exit by stopPhotonBuilder()
+std::thread photonThread;
+//Set (under photonMutex) at exit; every stage of a build checks it and gives up
+std::atomic<bool> photonQuit(false);
+uint64_t photonSeed = 0;
+int photonThreads = glm::max(1, (int)std::thread::hardware_concurrency());
+//--photon-importance: only emit photons into the cone around the scene's bounds when the light is outside them
+bool photonImportance = false;
+//Frames are saved by a background writer so the render loop never waits on the disk (unless --frame-queue fills
+//up without --drop-frames). Global so exiting through printMessageAndQuit still writes out what is queued.
+std::unique_ptr<FrameWriter> frameWriter;
+//Per-stage times and work counts, collected as each frame is swapped: onto the window with the HUD ('h' or
+//--hud) and/or as a line of JSON per frame to --profile-log
+FrameProfile profile;
+bool hudMode = false;
+std::ofstream profileLog;
+//--trace-events: written at exit
+std::string traceFile;
 bool photonmode = false;
-enum RenderMode { WIREFRAME, RASTERIZING, RAYTRACING };
+enum RenderMode { WIREFRAME, RASTERIZING, RAYTRACING, SPPM };
 
 RenderMode renderMode = RASTERIZING;
 
@@ -41,8 +135,87 @@ class Camera {
 
 Camera camera;
 
+//Stochastic progressive photon mapping: a visible point per pixel from the ray tracer, then per-pixel
+//gather radius and flux statistics refined by one batch of photons per frame
+struct VisiblePoint {
+	glm::vec3 loc;
+	glm::vec3 colour;
+	bool valid;
+};
+
+struct SPPMPixel {
+	float radius2;
+	float photons;
+	float flux;
+};
+
+std::vector<VisiblePoint> visiblePoints;
+std::vector<SPPMPixel> sppmPixels;
+int sppmPasses = 0;
+glm::vec3 sppmCameraPos;
+glm::mat3 sppmCameraRot;
+//Visible points are gathered a tile at a time, in this order; sppmTilesTraced is -1 until a gather starts
+std::vector<int> sppmTileOrder;
+int sppmTilesTraced = -1;
+
+//Start SPPM over from gathering visible points, after something they or the photons depend on changed
+void restartSPPM() {
+	sppmPasses = 0;
+	sppmTilesTraced = -1;
+}
+
 glm::vec3 lightSource;
 
+//Versions of what a frame is drawn from, bumped wherever they change: camera, light, and scene (the render mode
+//and display toggles too). pixelsVersion moves whenever the window's pixels do, which is what gets swapped to the front and saved.
+int cameraVersion = 0;
+int lightVersion = 0;
+int sceneVersion = 0;
+int pixelsVersion = 0;
+//Which parts of the frame draw() has to redo, and what each part was drawn from
+DirtyTiles tiles(WIDTH, HEIGHT, TILE_SIZE);
+
+//main() only runs SDL: it forwards input through inputQueue to the render thread, which handles it, draws into
+//the window's back buffer and swaps finished frames to the front for main() to present
+struct InputEvent {
+	SDL_Event event;
+	//where the mouse was when the event was polled
+	int mouseX;
+	int mouseY;
+};
+
+SPSCQueue<InputEvent, 256> inputQueue;
+//only for the render thread to sleep on while idle; the queue itself is lock-free
+std::mutex inputMutex;
+std::condition_variable inputWake;
+std::atomic<bool> renderQuit(false);
+std::thread renderThread;
+//The ray tracer works outward from here a tile at a time, swapping what it has every traceSliceMs (--trace-slice).
+//The screen centre, or the mouse with --trace-from-mouse.
+int traceFocusX = WIDTH / 2;
+int traceFocusY = HEIGHT / 2;
+bool traceFromMouse = false;
+int traceSliceMs = TRACE_SLICE_MS;
+//--frame-target: while the camera moves, each new position is drawn at 1/scale resolution, the scale picked
+//from what a full frame in the current mode has been measured to cost. The rasterizer draws a small frame and
+//scales it up; the ray tracer stops its progressive passes at scale x scale blocks. The full resolution frame
+//follows once the camera has been still for CAMERA_SETTLE_MS. 0 leaves it off.
+//Only camera motion is scaled: a still view that misses the target is refined at full resolution anyway, as the
+//ray tracer already goes in traceSliceMs slices and a scaled frame of a view that isn't moving would just be
+//replaced by the full one.
+double frameTargetMs = 0;
+//per render mode; negative until there's a measurement
+double fullFrameMs[SPPM + 1] = {-1, -1, -1, -1};
+int scaledCamera = -1;
+int seenCamera = -1;
+std::chrono::steady_clock::time_point cameraMoved;
+//Drawing time spent so far on the frame since the camera last moved, summed over the ray tracer's slices (its
+//coarse passes included); only a frame redrawn from a whole dirty screen says what a full frame costs
+double refineMs = 0;
+bool refineWhole = false;
+//what the rasterizer's projection divides screen coordinates by
+int drawScale = 1;
+
 std::vector<float> interpolateSingleFloats(float from, float to, int numberOfValues) {
 	std::vector<float> values(numberOfValues);
 
@@ -105,6 +278,7 @@ void drawLine(DrawingWindow &window, CanvasPoint from, CanvasPoint to, Colour co
 		if(X < 0 || X > WIDTH - 1 || Y < 0 || Y > HEIGHT - 1) {
 			continue;
 		}
+		if(!tiles.drawable(X, Y)) continue;
 
 	
 
@@ -230,8 +404,16 @@ CanvasPoint calcExtraTexturePoint(std::vector<CanvasPoint> rCanvas, std::vector<
 }
 
 
+const TextureMap &loadTexture(const std::string &path) {
+	std::unordered_map<std::string, TextureMap>::iterator found = textures.find(path);
+	if(found == textures.end()) found = textures.emplace(path, TextureMap(path)).first;
+	//compact textures are expanded the first time they're drawn
+	found->second.unpack();
+	return found->second;
+}
+
 void drawTexturedTriangle(DrawingWindow &window, CanvasTriangle triangle, std::string path) {
-	TextureMap texture(path);
+	const TextureMap &texture = loadTexture(path);
 	std::vector<CanvasPoint> initCanvasPoints({triangle.v0(),triangle.v1(),triangle.v2()});
 	std::vector<CanvasPoint> sortedCanvasPoints = getSortedTriangeVertices(initCanvasPoints);
 	
@@ -280,6 +462,7 @@ void drawTexturedTriangle(DrawingWindow &window, CanvasTriangle triangle, std::s
 			if(X < 0 || X > WIDTH - 1 || Y < 0 || Y > HEIGHT - 1) {
 				continue;
 			}
+			if(!tiles.drawable(X, Y)) continue;
 			if(cPixel.z == 0) {
 				ZBuffer[X][Y] = cPixel.z;
 				window.setPixelColour(X, Y, colour);
@@ -315,6 +498,7 @@ void drawTexturedTriangle(DrawingWindow &window, CanvasTriangle triangle, std::s
 			if(X < 0 || X > WIDTH - 1 || Y < 0 || Y > HEIGHT - 1) {
 				continue;
 			}
+			if(!tiles.drawable(X, Y)) continue;
 			if(cPixel.z == 0) {
 				ZBuffer[X][Y] = cPixel.z;
 				window.setPixelColour(X, Y, colour);
@@ -357,8 +541,9 @@ RayTriangleIntersection getRayTriangleIntersection(ModelTriangle triangle, glm::
 	RayTriangleIntersection result = RayTriangleIntersection();
 
 	bool found = false;
+	//only the vertices are read, never the colours recolourAt() may be changing
 	for(int i = 0; i < pairs.size() && !found; i++) {
-		ModelTriangle tri = pairs[i].first;
+		const ModelTriangle &tri = pairs[i].first;
 		if(tri.vertices[0] == triangle.vertices[0] && tri.vertices[1] == triangle.vertices[1] && tri.vertices[2] == triangle.vertices[2]) {
 			result.triangleIndex = i;
 			found = true;
@@ -381,106 +566,99 @@ CanvasTriangle getRandomTriangle() {
 	return triangle;
 }
 
-Material loadMaterial(std::string mtlName, std::string mtlPath) {
-    std::ifstream in(mtlPath, std::ifstream::in);
-	std::string line;
-	glm::vec3 colour;
-	std::string texturePath;
-	
-    bool found = false;
-    while(!found && !in.eof()) {
-	    std::getline(in, line);
-        std::vector<std::string> tokens = split(line, ' ');
-        if(tokens[0].compare("newmtl") == 0 && tokens[1].compare(mtlName) == 0) {
-            found = true;
-        }
-    }
-    found = false;
-	while(!in.eof() && !found) {
-        std::getline(in, line);
-        std::vector<std::string> tokens = split(line, ' ');
-        if(tokens[0].compare("Kd") == 0) {
-            colour = glm::vec3(0xFF*stof(tokens[1]), 0xFF*stof(tokens[2]), 0xFF*stof(tokens[3]));
-        }
-		if(tokens[0].compare("map_Kd") == 0) {
-			texturePath = tokens[1];
-		}
-		if(tokens[0].compare("newmtl") == 0) {
-			found = true;
-		}
-    }
-	Material material = Material(Colour(colour.r, colour.g, colour.b), texturePath, mtlName);
-    in.close();
-    return material;
-}
-
 std::vector<std::pair<ModelTriangle, Material>> loadObj(std::string path, float scale) {
-	std::ifstream file(path, std::ifstream::in);
-	std::string line;
-	
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	std::vector<std::pair<ModelTriangle, Material>> pairs;
-	std::vector<glm::vec3> vertices;
-	std::vector<TexturePoint> texturePoints;
-
-	Material material;
-	std::string mtlPath;
+	ObjMesh mesh;
+	if(!loadObjMesh(path, mesh, photonThreads)) {
+		std::cout << "could not read " << path << std::endl;
+		return pairs;
+	}
 
+	pairs.reserve(mesh.triangles.size());
+	for(size_t t = 0; t < mesh.triangles.size(); t++) {
+		const ObjTriangle &face = mesh.triangles[t];
+		Material material = face.material < 0 ? Material() : mesh.materials[face.material];
+		ModelTriangle triangle = ModelTriangle();
+		for(int i = 0; i < 3; i++) {
+			triangle.vertices[i] = scale * mesh.vertices[face.vertices[i]];
+			if(face.texturePoints[i] >= 0) triangle.texturePoints[i] = mesh.texturePoints[face.texturePoints[i]];
+		}
+		triangle.colour = material.colour;
+		glm::vec3 e0 = triangle.vertices[1] - triangle.vertices[0];
+		glm::vec3 e1 = triangle.vertices[2] - triangle.vertices[0];
+		triangle.normal = glm::normalize(glm::cross(e0, e1));
 
-	while(!file.eof()) {
-		std::getline(file, line);
-		std::vector<std::string> tokens = split(line, ' ');
+		pairs.push_back(std::pair<ModelTriangle,Material>(triangle,material));
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "loaded " << path << " (" << pairs.size() << " triangles) in " << seconds * 1000 << " ms" << std::endl;
+	return pairs;
+}
 
-				std::cout << line << std::endl;
-		if(tokens[0].compare("mtllib") == 0) mtlPath = tokens[1];
-		else if(tokens[0].compare("usemtl") == 0) {
-			material = loadMaterial(tokens[1], mtlPath);
-			if(tokens[1].compare("Mirror") == 0) material.mirror = true;
-		}
-		else if(tokens[0].compare("v") == 0) vertices.push_back(scale * glm::vec3(stof(tokens[1]), stof(tokens[2]), stof(tokens[3])));
-		else if(tokens[0].compare("vt") == 0) {
-			texturePoints.push_back(TexturePoint(stof(tokens[1]), stof(tokens[2])));
-		}
-		
-		else if(tokens[0].compare("f") == 0) {
-			//For each index in f
-			std::array<glm::vec3, 3> trianglePoints;
-			std::array<TexturePoint, 3> selectedTexturePoints;
-			for(int i = 1; i < 4; i++) {
-				std::vector<std::string> subTokens = split(tokens[i], '/');
-				//TrianglePoint
-				trianglePoints[i - 1] = vertices[stoi(subTokens[0]) - 1];
-				//TexturePoint
-				if(subTokens[1].compare("\0") != 0) {
-					selectedTexturePoints[i - 1] = texturePoints[stoi(subTokens[1]) - 1];
-				}
+//Load the scene from its compiled form in SCENE_CACHE, compiling that first if it's missing or stale,
+//and falling back to reading the OBJ files directly if it can't be written
+std::vector<std::pair<ModelTriangle, Material>> loadScene(const std::vector<std::string> &objPaths, float scale) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::pair<ModelTriangle, Material>> pairs;
+	SceneFile scene;
+	if(!scene.load(SCENE_CACHE, objPaths, scale)) {
+		std::cout << "compiling " << SCENE_CACHE << std::endl;
+		if(!SceneFile::compile(SCENE_CACHE, objPaths, scale, photonThreads) || !scene.load(SCENE_CACHE, objPaths, scale)) {
+			std::cout << "could not compile " << SCENE_CACHE << ", reading the OBJ files instead" << std::endl;
+			for(size_t i = 0; i < objPaths.size(); i++) {
+				std::vector<std::pair<ModelTriangle, Material>> object = loadObj(objPaths[i], scale);
+				pairs.insert(pairs.end(), object.begin(), object.end());
 			}
+			return pairs;
+		}
+	}
 
-			ModelTriangle triangle = ModelTriangle();
-			triangle.vertices = trianglePoints;
-			triangle.texturePoints = selectedTexturePoints;
-			triangle.colour = material.colour;
-			glm::vec3 e0 = triangle.vertices[1] - triangle.vertices[0];
-			glm::vec3 e1 = triangle.vertices[2] - triangle.vertices[0];
-			triangle.normal = glm::normalize(glm::cross(e0, e1));
-			
-			pairs.push_back(std::pair<ModelTriangle,Material>(triangle,material));
+	std::vector<Material> materials(scene.materialCount());
+	for(size_t m = 0; m < materials.size(); m++) materials[m] = scene.material(m);
+	for(size_t t = 0; t < scene.textureCount(); t++) textures[scene.texturePath(t)] = scene.texture(t);
+	const SceneTriangle *faces = scene.triangles();
+	pairs.reserve(scene.triangleCount());
+	for(size_t t = 0; t < scene.triangleCount(); t++) {
+		const SceneTriangle &face = faces[t];
+		Material material = face.material < 0 ? Material() : materials[face.material];
+		ModelTriangle triangle = ModelTriangle();
+		for(int i = 0; i < 3; i++) {
+			triangle.vertices[i] = scene.vertices()[face.vertices[i]];
+			if(face.texturePoints[i] >= 0) {
+				glm::vec2 uv = scene.texturePoints()[face.texturePoints[i]];
+				triangle.texturePoints[i] = TexturePoint(uv.x, uv.y);
+			}
 		}
+		triangle.colour = material.colour;
+		triangle.normal = scene.normals()[t];
+		pairs.push_back(std::pair<ModelTriangle,Material>(triangle,material));
 	}
-	
-	file.close();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "loaded " << SCENE_CACHE << " (" << pairs.size() << " triangles) in " << seconds * 1000 << " ms" << std::endl;
 	return pairs;
 }
 
-void drawModelTriangle(DrawingWindow &window, std::pair<ModelTriangle, Material> pair) {
+//Record which dirty tiles a projected triangle lands in; false if none, so it needn't be drawn this time
+bool dependOnTriangle(CanvasTriangle &triangle, int index) {
+	float minX = glm::min(triangle.v0().x, glm::min(triangle.v1().x, triangle.v2().x));
+	float minY = glm::min(triangle.v0().y, glm::min(triangle.v1().y, triangle.v2().y));
+	float maxX = glm::max(triangle.v0().x, glm::max(triangle.v1().x, triangle.v2().x));
+	float maxY = glm::max(triangle.v0().y, glm::max(triangle.v1().y, triangle.v2().y));
+	return tiles.dependOnBox(minX, minY, maxX, maxY, index);
+}
+
+void drawModelTriangle(DrawingWindow &window, std::pair<ModelTriangle, Material> pair, int index) {
 	ModelTriangle triangle = pair.first;
 	Material material = pair.second;
 
 	std::vector<glm::vec3> renderPos;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 	for(int i=0; i < triangle.vertices.size(); i++) {
 		glm::vec3 vertex = triangle.vertices[i] - camera.pos;
 		vertex = camera.rot * vertex;
-		float u = glm::floor(-1*camera.f*(vertex.x / vertex.z)*(HEIGHT*1.5)+ WIDTH/2);
-		float v = glm::floor(camera.f*(vertex.y / vertex.z)*(HEIGHT*1.5) + HEIGHT/2);
+		float u = glm::floor((-1*camera.f*(vertex.x / vertex.z)*(HEIGHT*1.5)+ WIDTH/2) / drawScale);
+		float v = glm::floor((camera.f*(vertex.y / vertex.z)*(HEIGHT*1.5) + HEIGHT/2) / drawScale);
 		float Z = INFINITY;
 		
 		if(vertex.z != 0.0) {
@@ -488,13 +666,17 @@ void drawModelTriangle(DrawingWindow &window, std::pair<ModelTriangle, Material>
 		}
 		renderPos.push_back(glm::vec3(u, v, Z));
 	}
+	profile.add(STAGE_TRANSFORM, std::chrono::steady_clock::now() - start);
 	CanvasTriangle transposedTri = CanvasTriangle(CanvasPoint(renderPos[0].x, renderPos[0].y, renderPos[0].z), CanvasPoint(renderPos[1].x, renderPos[1].y, renderPos[1].z) ,CanvasPoint(renderPos[2].x, renderPos[2].y, renderPos[2].z));
+	if(!dependOnTriangle(transposedTri, index)) return;
+	ScopedTimer timer(profile, STAGE_RASTER);
+	profile.count(COUNT_TRIANGLES, 1);
 
 	if(material.texturePath.empty()) {
 		drawFilledTriangle(window, transposedTri, triangle.colour, triangle.colour);
 
 	} else {		
-		TextureMap textureMap(material.texturePath);
+		const TextureMap &textureMap = loadTexture(material.texturePath);
 
 		transposedTri.v0().texturePoint = TexturePoint(triangle.texturePoints[0].x * textureMap.width, textureMap.height - triangle.texturePoints[0].y * textureMap.height);
 		transposedTri.v1().texturePoint = TexturePoint(triangle.texturePoints[1].x * textureMap.width, textureMap.height - triangle.texturePoints[1].y * textureMap.height);
@@ -552,208 +734,343 @@ float gaussian(float x, float m, float s) {
 	return (( 1 / ( s * sqrt(2*M_PI) ) ) * exp( -0.5 * pow( (x-m)/s, 2.0 )));
 }
 
-void rayTracing(DrawingWindow &window, std::vector<std::pair<ModelTriangle,Material>> pairs, float scale) {
-	//For each pixel on screen
-	for(int u = 0; u < WIDTH; u++) {
-		for(int v = 0; v < HEIGHT; v++) {
-			//Calc ray direction
-			glm::vec3 cameraSpaceCanvasPixel((u - WIDTH/2), (HEIGHT/2 - v), -camera.f*WIDTH);
-			glm::vec3 worldSpaceCanvasPixel = (cameraSpaceCanvasPixel * camera.rot) + camera.pos;
-			glm::vec3 rayDirection = glm::normalize(worldSpaceCanvasPixel - camera.pos);
-			std::vector<RayTriangleIntersection> intersections;
-			std::vector<Material> materials;
-			//Check if ray intersects any of tri planes
+//Photon estimate at a surface point, using gathered (MAX_GATHER long) as scratch space. Adds the number of
+//photons gathered to *photonsFound if it's given.
+float photonIntensity(const PhotonMaps &maps, glm::vec3 point, PhotonHit *gathered, uint64_t *photonsFound = NULL) {
+	//Get photons within the gather radius
+	int found = maps.globalPhotons->radiusSearch(point, PHOTON_RADIUS, gathered, MAX_GATHER);
+	if(photonsFound) *photonsFound += found;
+	float intensity = 0;
+	float factor = 0;
+	for(int i = 0; i < found; i++) {
+		float weight = gaussian(glm::sqrt(gathered[i].distance2), 0.0f, 0.4f);
+		intensity += gathered[i].intensity*weight;
+		factor += weight;
+	}
+	if(factor > 0) intensity /= factor;
+
+	//Caustics are a density estimate: caustic photon flux per unit area over a tighter radius
+	if(maps.causticEmitted == 0) return intensity;
+	found = maps.causticPhotons->radiusSearch(point, CAUSTIC_RADIUS, gathered, MAX_GATHER);
+	if(photonsFound) *photonsFound += found;
+	float flux = 0;
+	for(int i = 0; i < found; i++) flux += gathered[i].intensity;
+	return intensity + CAUSTIC_EXPOSURE * flux / (M_PI * CAUSTIC_RADIUS * CAUSTIC_RADIUS * maps.causticEmitted);
+}
+
+//What tracing did, counted in a local and added to the profile once per tile or frame instead of per ray
+struct TraceWork {
+	uint64_t rays = 0;
+	uint64_t intersections = 0;
+	uint64_t photons = 0;
+	std::chrono::steady_clock::duration gather = std::chrono::steady_clock::duration::zero();
+};
+
+void addTraceWork(const TraceWork &work) {
+	profile.count(COUNT_RAYS, work.rays);
+	profile.count(COUNT_INTERSECTIONS, work.intersections);
+	profile.count(COUNT_PHOTONS, work.photons);
+	profile.add(STAGE_GATHER, work.gather);
+}
+
+//Trace the ray through pixel (u, v), recording what its tile depends on and adding what it did to work
+void tracePixel(DrawingWindow &window, const std::vector<std::pair<ModelTriangle,Material>> &pairs, const PhotonMaps *maps, int u, int v, PhotonHit *gathered, TraceWork &work, std::vector<VisiblePoint> *visiblePoints) {
+	int tile = tiles.tileAt(u, v);
+	//Calc ray direction
+	glm::vec3 cameraSpaceCanvasPixel((u - WIDTH/2), (HEIGHT/2 - v), -camera.f*WIDTH);
+	glm::vec3 worldSpaceCanvasPixel = (cameraSpaceCanvasPixel * camera.rot) + camera.pos;
+	glm::vec3 rayDirection = glm::normalize(worldSpaceCanvasPixel - camera.pos);
+	std::vector<RayTriangleIntersection> intersections;
+	std::vector<Material> materials;
+	//Check if ray intersects any of tri planes
+	for(int i = 0; i < pairs.size(); i++) {
+		ModelTriangle triangle = pairs[i].first;
+		Material material = pairs[i].second;
+		//Check if intersects current triangle pace
+		glm::vec3 tuvVector = getPossibleIntersectionSolution(triangle, camera.pos, rayDirection);
+		//Is the intersection in the triangle
+		if(isValidIntersection(tuvVector)) {
+			RayTriangleIntersection intersection = getRayTriangleIntersection(triangle, tuvVector);
+			//Add intersection to vector
+			intersections.push_back(intersection);
+			materials.push_back(material);
+		}
+	}
+	work.rays++;
+	work.intersections += pairs.size();
+
+	if(!intersections.empty()) {
+		//Get closest intersection
+		RayTriangleIntersection closest = intersections[0];
+		Material closestMat = materials[0];
+		for(int i = 0; i < intersections.size(); i++) {
+			if(intersections[i].distanceFromCamera <= closest.distanceFromCamera){
+				closest = intersections[i];
+				closestMat = materials[i];
+			} 
+		}
+		tiles.depend(tile, closest.triangleIndex);
+
+		//Bounce mirror rays
+		bool sky = false;
+		RayTriangleIntersection prevInt = closest;
+		Material prevMat = closestMat;
+		if(closestMat.mirror) {
+			glm::vec3 rSrc = closest.intersectionPoint;
+			glm::vec3 rDir = glm::normalize(rSrc - camera.pos) - 2.0f*closest.intersectedTriangle.normal*glm::dot(glm::normalize(rSrc - camera.pos), closest.intersectedTriangle.normal);
+			std::vector<RayTriangleIntersection> ints;
+			std::vector<Material> mats;
+			RayTriangleIntersection cInt = closest;
+			Material cMat = closestMat;
+			work.rays++;
+			work.intersections += pairs.size();
+
 			for(int i = 0; i < pairs.size(); i++) {
-				ModelTriangle triangle = pairs[i].first;
-				Material material = pairs[i].second;
-				//Check if intersects current triangle pace
-				glm::vec3 tuvVector = getPossibleIntersectionSolution(triangle, camera.pos, rayDirection);
-				//Is the intersection in the triangle
-				if(isValidIntersection(tuvVector)) {
-					RayTriangleIntersection intersection = getRayTriangleIntersection(triangle, tuvVector);
+				ModelTriangle t = pairs[i].first;
+				Material m = pairs[i].second;
+				glm::vec3 tuv = getPossibleIntersectionSolution(t, rSrc, rDir);
+				if(isValidIntersection(tuv)) {
+					RayTriangleIntersection inte = getRayTriangleIntersection(t, tuv);
 					//Add intersection to vector
-					intersections.push_back(intersection);
-					materials.push_back(material);
+					if(tuv[0] > 0.001f){
+						ints.push_back(inte);
+						mats.push_back(m);
+					}
 				}
 			}
 
-			if(!intersections.empty()) {
-				//Get closest intersection
-				RayTriangleIntersection closest = intersections[0];
-				Material closestMat = materials[0];
-				for(int i = 0; i < intersections.size(); i++) {
-					if(intersections[i].distanceFromCamera <= closest.distanceFromCamera){
-						closest = intersections[i];
-						closestMat = materials[i];
+			if(!ints.empty()) {
+				cInt = ints[0];
+				cMat = materials[0];
+				for(int i = 0; i < ints.size(); i++) {
+					if(glm::distance(ints[i].intersectionPoint, rSrc) <= glm::distance(cInt.intersectionPoint, rSrc)){
+						cInt = ints[i];
+						cMat = mats[i];
 					} 
-				}
+				}	
+			} 
+			else {
+				
+				sky = true;
+			}
+			closest = cInt;
+			closestMat = cMat;
+			if(!sky) tiles.depend(tile, closest.triangleIndex);
+		}
 
-				//Bounce mirror rays
-				bool sky = false;
-				RayTriangleIntersection prevInt = closest;
-				Material prevMat = closestMat;
-				if(closestMat.mirror) {
-					glm::vec3 rSrc = closest.intersectionPoint;
-					glm::vec3 rDir = glm::normalize(rSrc - camera.pos) - 2.0f*closest.intersectedTriangle.normal*glm::dot(glm::normalize(rSrc - camera.pos), closest.intersectedTriangle.normal);
-					std::vector<RayTriangleIntersection> ints;
-					std::vector<Material> mats;
-					RayTriangleIntersection cInt = closest;
-					Material cMat = closestMat;
-
-					for(int i = 0; i < pairs.size(); i++) {
-						ModelTriangle t = pairs[i].first;
-						Material m = pairs[i].second;
-						glm::vec3 tuv = getPossibleIntersectionSolution(t, rSrc, rDir);
-						if(isValidIntersection(tuv)) {
-							RayTriangleIntersection inte = getRayTriangleIntersection(t, tuv);
-							//Add intersection to vector
-							if(tuv[0] > 0.001f){
-								ints.push_back(inte);
-								mats.push_back(m);
-							}
-						}
-					}
+		float intensity = 0;
+		if(maps) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if(irradianceMode && maps->irradianceExists) intensity = maps->irradiance.lookup(closest.intersectionPoint, closest.intersectedTriangle.normal, PHOTON_RADIUS);
+			else intensity = photonIntensity(*maps, closest.intersectionPoint, gathered, &work.photons);
+			work.gather += std::chrono::steady_clock::now() - start;
+		}
 
-					if(!ints.empty()) {
-						cInt = ints[0];
-						cMat = materials[0];
-						for(int i = 0; i < ints.size(); i++) {
-							if(glm::distance(ints[i].intersectionPoint, rSrc) <= glm::distance(cInt.intersectionPoint, rSrc)){
-								cInt = ints[i];
-								cMat = mats[i];
-							} 
-						}	
-					} 
-					else {
-						
-						sky = true;
+		//Phong shading
+		std::vector<glm::vec3> vertexNormals = calcVertexNormals(closest.intersectedTriangle);
+		glm::vec3 tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, camera.pos, rayDirection);
+		// glm::vec3 tuv;
+		// if(!prevMat.mirror) tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, camera.pos, rayDirection);
+		// else tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, prevInt.intersectionPoint, glm::normalize(closest.intersectionPoint - prevInt.intersectionPoint));
+		float v2Factor = tuv[2];
+		float v1Factor = tuv[1];
+		float v0Factor = 1.0f - v2Factor - v1Factor;
+		glm::vec3 phongNormal = glm::normalize((v0Factor * vertexNormals[0] + v1Factor * vertexNormals[1] + v2Factor * vertexNormals[2]));
+		
+		//?? shading
+		// int res = 1000;
+		// std::vector<glm::vec3> e01normals = interpolateVector(vertexNormals[0], vertexNormals[1], res);
+		// std::vector<glm::vec3> e02normals = interpolateVector(vertexNormals[0], vertexNormals[2], res);
+		// std::vector<glm::vec3> e12normals = interpolateVector(vertexNormals[1], vertexNormals[2], res);
+		// int distance = glm::round((tuv[1] + tuv[2])*res);
+		// std::vector<glm::vec3> internormals = interpolateVector(e01normals[distance], e02normals[distance], res);
+		// glm::vec3 phongNormal = internormals[glm::round(tuv[2]*res)];
+
+		//Flat shading
+		glm::vec3 flatNormal = closest.intersectedTriangle.normal;
+		glm::vec3 normal = flatNormal;
+		if(closestMat.name == "Sphere") {
+			normal = phongNormal;
+		}
+		
+		// std::cout << "Intensity" << intensity << "Distance" << glm::distance(photons[photons.size() - 1]->loc, closest.intersectionPoint) << std::endl;
+		//Cast shadow ray
+		glm::vec3 shadowRayDirection = glm::normalize(lightSource - closest.intersectionPoint);
+		glm::vec3 shadowRayTuv;
+
+		bool shadow = false;
+		if(!sky) work.rays++;
+		for(int i = 0; i < pairs.size() && !shadow && !sky; i++) {
+			if(closest.triangleIndex != i) {
+				work.intersections++;
+				shadowRayTuv = getPossibleIntersectionSolution(pairs[i].first, closest.intersectionPoint, shadowRayDirection);
+				if(isValidIntersection(shadowRayTuv)) {
+					RayTriangleIntersection shadowIntersect = getRayTriangleIntersection(pairs[i].first, shadowRayTuv);	
+
+					if(shadowIntersect.distanceFromCamera < glm::distance(lightSource, closest.intersectionPoint)) {
+						shadow = true;
+					}else {
+						// glm::vec3 normal = closest.intersectedTriangle.normal;
+						glm::vec3 facing = glm::normalize(camera.pos - closest.intersectionPoint);
+						float angle = glm::acos(glm::dot(facing, normal));
+						if(angle > M_PI / 2) shadow = true;
 					}
-					std::cout << "intersectionc" << std::endl;
-					closest = cInt;
-					closestMat = cMat;
+					if(shadow) tiles.depend(tile, i);
 				}
+			}
+		}
 
-				//Get photon
-				std::vector<Node*> photons = PHOTONMAP.beginSearch(closest.intersectionPoint);
-				float intensity = 0;
-				int n = 0;
-				float factor = 0;
-				// int n = (int)photons.size();
-				for(int i = 0; i < photons.size(); i++) {
-					float d = glm::distance(closest.intersectionPoint, photons[i]->loc);
-					if(d <= 0.05f){
-						// intensity += photons[i]->intensity*glm::exp(-d);
-						intensity += photons[i]->intensity*gaussian(d, 0.0f, 0.4f);
-						factor+=gaussian(d, 0.0f, 0.4f);
-						n++;
-					}
-				}
-				intensity /= factor;
-
-				//Phong shading
-				std::vector<glm::vec3> vertexNormals = calcVertexNormals(closest.intersectedTriangle);
-				glm::vec3 tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, camera.pos, rayDirection);
-				// glm::vec3 tuv;
-				// if(!prevMat.mirror) tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, camera.pos, rayDirection);
-				// else tuv = getPossibleIntersectionSolution(closest.intersectedTriangle, prevInt.intersectionPoint, glm::normalize(closest.intersectionPoint - prevInt.intersectionPoint));
-				float v2Factor = tuv[2];
-				float v1Factor = tuv[1];
-				float v0Factor = 1.0f - v2Factor - v1Factor;
-				glm::vec3 phongNormal = glm::normalize((v0Factor * vertexNormals[0] + v1Factor * vertexNormals[1] + v2Factor * vertexNormals[2]));
-				
-				//?? shading
-				// int res = 1000;
-				// std::vector<glm::vec3> e01normals = interpolateVector(vertexNormals[0], vertexNormals[1], res);
-				// std::vector<glm::vec3> e02normals = interpolateVector(vertexNormals[0], vertexNormals[2], res);
-				// std::vector<glm::vec3> e12normals = interpolateVector(vertexNormals[1], vertexNormals[2], res);
-				// int distance = glm::round((tuv[1] + tuv[2])*res);
-				// std::vector<glm::vec3> internormals = interpolateVector(e01normals[distance], e02normals[distance], res);
-				// glm::vec3 phongNormal = internormals[glm::round(tuv[2]*res)];
-
-				//Flat shading
-				glm::vec3 flatNormal = closest.intersectedTriangle.normal;
-				glm::vec3 normal = flatNormal;
-				if(closestMat.name == "Sphere") {
-					normal = phongNormal;
-				}
-				
+		//outside the photon view every surface pixel is shaded by (or shadowed from) the light
+		if(!sky && !photonmode) tiles.dependOnLight(tile);
 
-				std::cout << closestMat.mirror << std::endl;
-				
-				// std::cout << "Intensity" << intensity << "Distance" << glm::distance(photons[photons.size() - 1]->loc, closest.intersectionPoint) << std::endl;
-				//Cast shadow ray
-				glm::vec3 shadowRayDirection = glm::normalize(lightSource - closest.intersectionPoint);
-				glm::vec3 shadowRayTuv;
-
-				bool shadow = false;
-				for(int i = 0; i < pairs.size() && !shadow && !sky; i++) {
-					if(closest.triangleIndex != i) {
-						shadowRayTuv = getPossibleIntersectionSolution(pairs[i].first, closest.intersectionPoint, shadowRayDirection);
-						if(isValidIntersection(shadowRayTuv)) {
-							RayTriangleIntersection shadowIntersect = getRayTriangleIntersection(pairs[i].first, shadowRayTuv);	
-
-							if(shadowIntersect.distanceFromCamera < glm::distance(lightSource, closest.intersectionPoint)) {
-								shadow = true;
-							}else {
-								// glm::vec3 normal = closest.intersectedTriangle.normal;
-								glm::vec3 facing = glm::normalize(camera.pos - closest.intersectionPoint);
-								float angle = glm::acos(glm::dot(facing, normal));
-								if(angle > M_PI / 2) shadow = true;
-							}
-						}
-					}
-				}
+		if(visiblePoints != NULL && !sky) {
+			glm::vec3 colour(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
+			(*visiblePoints)[v * WIDTH + u] = VisiblePoint{closest.intersectionPoint, colour, true};
+		}
 
-				//Paint to screen
-				if(sky) {
-					window.setPixelColour(u,v, colourPack(Colour(0.0f, 0.0f, 0.0f), 0xFF));
-				  
-				}
-				else if(!shadow) {
+		//Paint to screen
+		if(sky) {
+			window.setPixelColour(u,v, colourPack(Colour(0.0f, 0.0f, 0.0f), 0xFF));
+		  
+		}
+		else if(!shadow) {
+	
+			glm::vec3 lightDirection = glm::normalize(lightSource - closest.intersectionPoint);
+			glm::vec3 cameraDirection = glm::normalize(camera.pos - closest.intersectionPoint);
+
+			//Specular 
+			glm::vec3 rReflection = -lightDirection - 2.0f*normal*glm::dot(-lightDirection, normal);
+			float specular = 255.0f*glm::pow(glm::dot(rReflection, cameraDirection), 60);
+			// std::cout << specular << std::endl;
+
+			//Incidence Lighting
+			float angle = glm::acos(glm::dot(normal, lightDirection)); //radians
+			float incidence;
+			if(angle > M_PI / 2) {
+				incidence = 0;
+			} else {
+				incidence = 1.0f - 2*angle/M_PI;
+			}
+			//Light falloff
+			float r = glm::distance(lightSource, closest.intersectionPoint);
+			float falloff = 1.0f/(4*M_PI*r*r);
+
+			glm::vec3 colour;
+			if(photonmode) colour = intensity * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
+			else colour = glm::clamp(specular + 5.0f*glm::clamp(falloff* incidence, 0.1f, 1.0f) * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue), 0.0f, 255.0f);
+
+			// glm::vec3 colour = 255.0f * glm::abs(pixelNormal);
+			window.setPixelColour(u,v,colourPack(Colour(colour.r, colour.g, colour.b), 0xFF));
+		} else {
+			glm::vec3 colour;
+			if(photonmode) colour = intensity * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
+			else colour = 0.2f * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
 			
-					glm::vec3 lightDirection = glm::normalize(lightSource - closest.intersectionPoint);
-					glm::vec3 cameraDirection = glm::normalize(camera.pos - closest.intersectionPoint);
-
-					//Specular 
-					glm::vec3 rReflection = -lightDirection - 2.0f*normal*glm::dot(-lightDirection, normal);
-					float specular = 255.0f*glm::pow(glm::dot(rReflection, cameraDirection), 60);
-					// std::cout << specular << std::endl;
-
-					//Incidence Lighting
-					float angle = glm::acos(glm::dot(normal, lightDirection)); //radians
-					float incidence;
-					if(angle > M_PI / 2) {
-						incidence = 0;
-					} else {
-						incidence = 1.0f - 2*angle/M_PI;
-					}
-					//Light falloff
-					float r = glm::distance(lightSource, closest.intersectionPoint);
-					float falloff = 1.0f/(4*M_PI*r*r);
-
-					glm::vec3 colour;
-					if(photonmode) colour = intensity * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
-					else colour = glm::clamp(specular + 5.0f*glm::clamp(falloff* incidence, 0.1f, 1.0f) * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue), 0.0f, 255.0f);
+			// glm::vec3 colour = intensity*glm::vec3(0xFF);
 		
-					// glm::vec3 colour = 255.0f * glm::abs(pixelNormal);
-					window.setPixelColour(u,v,colourPack(Colour(colour.r, colour.g, colour.b), 0xFF));
-				} else {
-					glm::vec3 colour;
-					if(photonmode) colour = intensity * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
-					else colour = 0.2f * glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue);
-					
-					// glm::vec3 colour = intensity*glm::vec3(0xFF);
-				
-					window.setPixelColour(u,v,colourPack(Colour(colour.r, colour.g, colour.b), 0xFF));
-				}
+			window.setPixelColour(u,v,colourPack(Colour(colour.r, colour.g, colour.b), 0xFF));
+		}
+	}
+}
+
+//Trace every pixel of a tile at full resolution, recording the first diffuse surface each one sees in
+//visiblePoints (row-major) for SPPM
+void traceVisibleTile(DrawingWindow &window, const std::vector<std::pair<ModelTriangle,Material>> &pairs, const PhotonMaps *maps, int tile, PhotonHit *gathered) {
+	ScopedTimer timer(profile, STAGE_TRACE);
+	TraceScope scope("visible points");
+	int x0, y0, x1, y1;
+	tiles.bounds(tile, x0, y0, x1, y1);
+	tiles.beginTile(tile);
+	TraceWork work;
+	for(int u = x0; u < x1; u++) {
+		for(int v = y0; v < y1; v++) {
+			window.setPixelColour(u, v, 0);
+			tracePixel(window, pairs, maps, u, v, gathered, work, &visiblePoints);
+		}
+	}
+	addTraceWork(work);
+}
+
+//One pass over a tile: pass 0 traces a ray per COARSEST_BLOCK square block and fills the block with it, each
+//pass after halves the blocks, only tracing the samples the coarser passes didn't, down to every pixel
+void traceTilePass(DrawingWindow &window, const std::vector<std::pair<ModelTriangle,Material>> &pairs, const PhotonMaps *maps, int tile, PhotonHit *gathered) {
+	ScopedTimer timer(profile, STAGE_TRACE);
+	TraceScope scope("tile");
+	int pass = tiles.passesDone(tile);
+	int block = glm::max(1, COARSEST_BLOCK >> pass);
+	int x0, y0, x1, y1;
+	tiles.bounds(tile, x0, y0, x1, y1);
+	if(pass == 0) tiles.beginTile(tile);
+	TraceWork work;
+	for(int u = x0; u < x1; u += block) {
+		for(int v = y0; v < y1; v += block) {
+			if(pass > 0 && (u - x0) % (2 * block) == 0 && (v - y0) % (2 * block) == 0) continue;
+			window.setPixelColour(u, v, 0);
+			tracePixel(window, pairs, maps, u, v, gathered, work, NULL);
+			uint32_t colour = window.getPixelColour(u, v);
+			for(int x = u; x < glm::min(u + block, x1); x++) {
+				for(int y = v; y < glm::min(v + block, y1); y++) window.setPixelColour(x, y, colour);
 			}
 		}
+	}
+	addTraceWork(work);
+	if(block == 1) tiles.finishTile(tile);
+	else tiles.finishPass(tile);
+}
 
+//Input to handle or the program quitting: what long drawing work checks so it can stop early
+bool renderInterrupted() {
+	return !inputQueue.empty() || renderQuit;
+}
+
+//Whether a tile with this many passes done has been traced down to blocks of block x block or finer
+bool refinedTo(int passes, int block) {
+	return passes > 0 && (COARSEST_BLOCK >> (passes - 1)) <= block;
+}
+
+//True once every dirty tile is refinedTo(block)
+bool tilesRefinedTo(int block) {
+	for(int t = 0; t < tiles.columns * tiles.rows; t++) {
+		if(tiles.isDirty(t) && !refinedTo(tiles.passesDone(t), block)) return false;
 	}
+	return true;
 }
 
+//Trace the dirty tiles a pass at a time, the whole screen coarse before any of it fine and nearest the focus
+//first within a pass. Stops after sliceMs or as soon as input arrives, so a camera or mode change never waits
+//on more than the tile in hand. Whatever isn't reached stays dirty for the next call; a change only sends the
+//tiles it marks back to the coarsest pass. Passes finer than finestBlock are left for a later call.
+void traceTiles(DrawingWindow &window, const std::vector<std::pair<ModelTriangle,Material>> &pairs, int sliceMs, int finestBlock = 1) {
+	TraceScope scope("trace slice");
+	std::vector<PhotonHit> gathered(MAX_GATHER);
+	std::shared_ptr<const PhotonMaps> maps = std::atomic_load(&photonMaps);
+	std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now() + std::chrono::milliseconds(sliceMs);
+	std::vector<int> order = tiles.nearestFirst(traceFocusX, traceFocusY);
+	while(!order.empty()) {
+		int pass = tiles.passesDone(order[0]);
+		for(size_t i = 1; i < order.size(); i++) pass = glm::min(pass, tiles.passesDone(order[i]));
+		if(refinedTo(pass, finestBlock)) return;
+		for(size_t i = 0; i < order.size(); i++) {
+			if(tiles.passesDone(order[i]) != pass) continue;
+			if(renderInterrupted() || std::chrono::steady_clock::now() >= stop) return;
+			traceTilePass(window, pairs, maps.get(), order[i], gathered.data());
+		}
+		order = tiles.nearestFirst(traceFocusX, traceFocusY);
+	}
+}
 
-void handleEvent(SDL_Event event, DrawingWindow &window) {
+
+//Defined with the photon map builder further down
+void moveLight(glm::vec3 offset);
+void invalidatePhotonMaps();
+void recolourAt(int u, int v);
+
+void handleEvent(const InputEvent &input, DrawingWindow &window) {
+	SDL_Event event = input.event;
+	Camera previousCamera = camera;
+	RenderMode previousMode = renderMode;
+	bool previousPhotonmode = photonmode;
+	bool previousIrradiance = irradianceMode;
 	if (event.type == SDL_KEYDOWN) {
 		if (event.key.keysym.sym == SDLK_LEFT) {
 			camera.pos = glm::vec3(camera.pos.x - camera.speed, camera.pos.y, camera.pos.z);
@@ -833,18 +1150,20 @@ void handleEvent(SDL_Event event, DrawingWindow &window) {
 		else if (event.key.keysym.sym == SDLK_u) {
 			std::cout << "u" << std::endl;
 			drawTriangle(window,getRandomTriangle(),Colour(rand() % 255, rand() % 255, rand() % 255));
+			pixelsVersion++;
 		}
 		else if (event.key.keysym.sym == SDLK_f) {
 			std::cout << "f" << std::endl;
 			drawFilledTriangle(window,getRandomTriangle(),Colour(0xFF,0xFF,0xFF),Colour(rand() % 255, rand() % 255, rand() % 255));
+			pixelsVersion++;
 		}
 		else if (event.key.keysym.sym == SDLK_g) {
 			std::cout << "g" << std::endl;
-			lightSource.y -= 0.1;
+			moveLight(glm::vec3(0, -0.1, 0));
 		}
 		else if (event.key.keysym.sym == SDLK_b) {
 			std::cout << "b" << std::endl;
-			lightSource.y += 0.1;
+			moveLight(glm::vec3(0, 0.1, 0));
 		}
 		else if(event.key.keysym.sym == SDLK_t) {
 			std::cout << "t" << std::endl;
@@ -859,6 +1178,10 @@ void handleEvent(SDL_Event event, DrawingWindow &window) {
 			CanvasTriangle textureTriangle(p0,p1,p2);
 			drawTexturedTriangle(window, textureTriangle, "texture.ppm");
 			drawTriangle(window, textureTriangle,Colour(0xFF,0xFF,0xFF));
+			pixelsVersion++;
+		}
+		else if(event.key.keysym.sym == SDLK_c) {
+			recolourAt(input.mouseX, input.mouseY);
 		}
 		else if(event.key.keysym.sym == SDLK_m) {
 			std::cout << "Rasterizing" << std::endl;
@@ -871,6 +1194,11 @@ void handleEvent(SDL_Event event, DrawingWindow &window) {
 			std::cout << "RayTracing" << std::endl;
 			renderMode = RAYTRACING;
 		}
+		else if(event.key.keysym.sym == SDLK_p) {
+			std::cout << "Progressive photon mapping" << std::endl;
+			renderMode = SPPM;
+			restartSPPM();
+		}
 		else if(event.key.keysym.sym == SDLK_n) {
 			std::cout << "Wireframe" << std::endl;
 			renderMode = WIREFRAME;
@@ -879,119 +1207,673 @@ void handleEvent(SDL_Event event, DrawingWindow &window) {
 			std::cout << "photons" << std::endl;
 			photonmode = !photonmode;
 		}
+		else if(event.key.keysym.sym == SDLK_h) hudMode = !hudMode;
+		else if(event.key.keysym.sym == SDLK_i) {
+			irradianceMode = !irradianceMode;
+			std::cout << "precomputed irradiance " << (irradianceMode ? "on" : "off") << std::endl;
+			//the current maps were published without a cache, so have the builder redo them with one
+			std::shared_ptr<const PhotonMaps> maps = std::atomic_load(&photonMaps);
+			if(irradianceMode && maps && !maps->irradianceExists) invalidatePhotonMaps();
+		}
 	} else if (event.type == SDL_MOUSEBUTTONDOWN) window.savePPM("output.ppm");
+	if (camera.pos != previousCamera.pos || camera.rot != previousCamera.rot) cameraVersion++;
+	if (renderMode != previousMode || photonmode != previousPhotonmode || irradianceMode != previousIrradiance) sceneVersion++;
 }
 
-KDTree photonMap(std::vector<std::pair<ModelTriangle, Material>> pairs, int amount) {
-	std::cout << "building photon map" << std::endl;
-	std::vector<glm::vec4> photons;
-	for(int p = 0; p < amount; p++) {
-		glm::vec3 pDirection = glm::normalize(glm::vec3(rand()%1000 - 500, rand()%1000 - 500, rand()%1000 - 500));
-		glm::vec3 pOrigin = lightSource;
-		std::vector<RayTriangleIntersection> intersections;
-		float intensity = 1.0f;
-		bool dead = false;
-		// std::cout << "new" << std::endl;
-		while(!dead) {
-			intersections.clear();
-			for(int i = 0; i < pairs.size(); i++) {
-					ModelTriangle triangle = pairs[i].first;
-					Material material = pairs[i].second;
-					glm::vec3 tuvVector = getPossibleIntersectionSolution(triangle, pOrigin, pDirection);
-					if(isValidIntersection(tuvVector)) {
-						RayTriangleIntersection intersection = getRayTriangleIntersection(triangle, tuvVector);
-						//Add intersection to vector
-						intersections.push_back(intersection);
-					}
-			}
-			// std::cout << intensity << std::endl;
-			if(intersections.empty()) dead = true;
-			else{
-				
-				RayTriangleIntersection closest = intersections[0];
-				for(int i = 1; i < intersections.size(); i++) {
-					if(glm::distance(intersections[i].intersectionPoint, pOrigin) <= glm::distance(closest.intersectionPoint, pOrigin)){
-						closest = intersections[i];
-					} 
-				}
-				
-				// std::cout << intensity << std::endl;
-				photons.push_back(glm::vec4(closest.intersectionPoint, intensity));
-				
-				// intensity *= 0.8*glm::length(glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue))/glm::length(glm::vec3(255.0f, 255.0f, 255.0f)); //check this val correct
-				intensity *= 0.4;
-				if(rand()%100 < 50) dead = true;
-				else {
-					glm::vec3 rReflection = pDirection - 2.0f*closest.intersectedTriangle.normal*glm::dot(pDirection, closest.intersectedTriangle.normal);
-					// float theta = (rand() % 100)*M_PI/400;
-					// glm::mat3 xRot = {1, 0, 0, 0, cos(theta), -sin(theta), 0, sin(theta), cos(theta)};
-					// glm::mat3 yRot = {cos(theta), 0, sin(theta), 0, 1, 0, -sin(theta), 0, cos(theta)};
-					// glm::mat3 zRot = {cos(theta), -sin(theta), 0, sin(theta), cos(theta), 0, 0, 0, 1};
-					// // pDirection = zRot * yRot * xRot * rReflection;
-					pOrigin = closest.intersectionPoint;
-					pDirection = rReflection;
-				}
+//Closest triangle hit further than minDistance along the ray; triangleIndex is set to its index in pairs
+bool closestIntersection(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 origin, glm::vec3 direction, float minDistance, RayTriangleIntersection &closest) {
+	bool hit = false;
+	for(int i = 0; i < pairs.size(); i++) {
+		glm::vec3 tuvVector = getPossibleIntersectionSolution(pairs[i].first, origin, direction);
+		if(isValidIntersection(tuvVector) && tuvVector[0] > minDistance && (!hit || tuvVector[0] <= closest.distanceFromCamera)) {
+			closest = getRayTriangleIntersection(pairs[i].first, tuvVector);
+			closest.triangleIndex = i;
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+//Give the object under pixel (u, v) - every triangle sharing its material - a random colour. Only the tiles
+//that showed it (or its shadow) are redrawn. Photons carry the colours they bounce off, so the photon maps are
+//rebuilt as for a light move.
+void recolourAt(int u, int v) {
+	glm::vec3 cameraSpaceCanvasPixel((u - WIDTH/2), (HEIGHT/2 - v), -camera.f*WIDTH);
+	glm::vec3 rayDirection = glm::normalize(cameraSpaceCanvasPixel * camera.rot);
+	RayTriangleIntersection hit;
+	if(!closestIntersection(pairs, camera.pos, rayDirection, 0.0f, hit)) return;
+	std::string name = pairs[hit.triangleIndex].second.name;
+	Colour colour(rand() % 255, rand() % 255, rand() % 255);
+	std::vector<int> changed;
+	{
+		//the builder copies the scene under the same lock
+		std::lock_guard<std::mutex> lock(photonMutex);
+		for(int i = 0; i < pairs.size(); i++) {
+			if(i != (int)hit.triangleIndex && (name.empty() || pairs[i].second.name != name)) continue;
+			pairs[i].first.colour = colour;
+			pairs[i].second.colour = colour;
+			changed.push_back(i);
+		}
+		photonVersion++;
+	}
+	photonWake.notify_one();
+	tiles.markTriangles(changed);
+	restartSPPM();
+	std::cout << "recoloured " << (name.empty() ? "triangle" : name) << " (" << changed.size() << " triangles, " << tiles.count() << " tiles to redraw)" << std::endl;
+}
+
+//Where global photons leave the light: a cone of directions (the whole sphere unless importance sampling
+//narrowed it), stratified by a Sobol sequence
+struct PhotonEmitter {
+	glm::vec3 light;
+	glm::vec3 axis;
+	glm::vec3 tangent;
+	glm::vec3 bitangent;
+	float cosMax;
+	//fraction of the sphere's solid angle the cone covers
+	float fraction;
+	Sobol sobol;
+};
+
+PhotonEmitter photonEmitter(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 light) {
+	PCG32 rng(photonSeed, 1ULL << 33);
+	uint32_t scrambleX = rng.next();
+	uint32_t scrambleY = rng.next();
+	PhotonEmitter emitter = {light, glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1), -1.0f, 1.0f, Sobol(scrambleX, scrambleY)};
+	if(!photonImportance || pairs.empty()) return emitter;
+
+	glm::vec3 lower = pairs[0].first.vertices[0];
+	glm::vec3 upper = lower;
+	for(int i = 0; i < pairs.size(); i++) {
+		for(int v = 0; v < 3; v++) {
+			lower = glm::min(lower, pairs[i].first.vertices[v]);
+			upper = glm::max(upper, pairs[i].first.vertices[v]);
+		}
+	}
+	//Bound the box by a sphere; from outside it, the sphere subtends a cone that catches every photon that can land
+	glm::vec3 centre = (lower + upper) * 0.5f;
+	float radius = glm::length(upper - centre);
+	float distance = glm::length(centre - light);
+	if(distance <= radius) return emitter;
+	float sinMax = radius / distance;
+	emitter.cosMax = glm::sqrt(1.0f - sinMax * sinMax);
+	emitter.fraction = (1.0f - emitter.cosMax) * 0.5f;
+	emitter.axis = (centre - light) / distance;
+	glm::vec3 up = glm::abs(emitter.axis.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+	emitter.tangent = glm::normalize(glm::cross(up, emitter.axis));
+	emitter.bitangent = glm::cross(emitter.axis, emitter.tangent);
+	return emitter;
+}
+
+//Direction of photon index: Sobol point index mapped uniformly (in cos(theta) and phi) onto the emission cone
+glm::vec3 emitDirection(const PhotonEmitter &emitter, uint64_t index) {
+	float u, v;
+	emitter.sobol.sample((uint32_t)index, u, v);
+	float cosTheta = 1.0f - u * (1.0f - emitter.cosMax);
+	float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * M_PI * v;
+	return emitter.axis * cosTheta + (emitter.tangent * glm::cos(phi) + emitter.bitangent * glm::sin(phi)) * sinTheta;
+}
+
+//Trace one photon from the emitter, appending a record at every surface it lands on.
+//Its random numbers come only from (photonSeed, index), so the result doesn't depend on which thread runs it.
+void tracePhoton(const std::vector<std::pair<ModelTriangle, Material>> &pairs, const PhotonEmitter &emitter, uint64_t index, std::vector<PhotonRecord> &photons) {
+	PCG32 rng(photonSeed, index);
+	glm::vec3 pDirection = emitDirection(emitter, index);
+	glm::vec3 pOrigin = emitter.light;
+	float intensity = 1.0f;
+	for(int bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+		RayTriangleIntersection closest;
+		if(!closestIntersection(pairs, pOrigin, pDirection, 0.0f, closest)) return;
+
+		photons.push_back(PhotonRecord{closest.intersectionPoint, glm::vec3(intensity), pDirection});
+
+		// intensity *= 0.8*glm::length(glm::vec3(closestMat.colour.red, closestMat.colour.green, closestMat.colour.blue))/glm::length(glm::vec3(255.0f, 255.0f, 255.0f)); //check this val correct
+		intensity *= 0.4;
+		if(rng.nextFloat() < 0.5f) return;
+		glm::vec3 rReflection = pDirection - 2.0f*closest.intersectedTriangle.normal*glm::dot(pDirection, closest.intersectedTriangle.normal);
+		pOrigin = closest.intersectionPoint;
+		pDirection = rReflection;
+	}
+}
+
+//Directions from the light split into equal solid angle cells (uniform in cos(theta) and phi)
+glm::vec3 projectionDirection(int cell, float u, float v) {
+	float cosTheta = 1.0f - 2.0f * ((cell / PROJECTION_RES) + u) / PROJECTION_RES;
+	float sinTheta = glm::sqrt(glm::max(0.0f, 1.0f - cosTheta * cosTheta));
+	float phi = 2.0f * M_PI * ((cell % PROJECTION_RES) + v) / PROJECTION_RES;
+	return glm::vec3(sinTheta * glm::cos(phi), cosTheta, sinTheta * glm::sin(phi));
+}
+
+//Cells whose directions from the light reach specular geometry first (sampled at a 3x3 grid per cell)
+std::vector<int> projectionMap(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 light) {
+	std::vector<int> cells;
+	for(int cell = 0; cell < PROJECTION_RES * PROJECTION_RES; cell++) {
+		bool specular = false;
+		for(int s = 0; s < 9 && !specular; s++) {
+			RayTriangleIntersection hit;
+			glm::vec3 direction = projectionDirection(cell, (s / 3) * 0.5f, (s % 3) * 0.5f);
+			if(closestIntersection(pairs, light, direction, 0.0f, hit)) specular = pairs[hit.triangleIndex].second.mirror;
+		}
+		if(specular) cells.push_back(cell);
+	}
+	return cells;
+}
+
+//Trace one caustic photon through a random projection map cell. Only light->specular->...->diffuse paths are kept,
+//stored at the first diffuse surface, with intensity as flux: the fraction of the sphere the cells cover
+//(to be divided by the number of caustic photons emitted)
+void traceCausticPhoton(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 light, const std::vector<int> &cells, int index, std::vector<PhotonRecord> &photons) {
+	PCG32 rng(photonSeed, (1ULL << 32) + index);
+	int cell = cells[(int)(((uint64_t)rng.next() * cells.size()) >> 32)];
+	glm::vec3 pDirection = projectionDirection(cell, rng.nextFloat(), rng.nextFloat());
+	glm::vec3 pOrigin = light;
+	float flux = (float)cells.size() / (PROJECTION_RES * PROJECTION_RES);
+	for(int bounce = 0; bounce < MAX_BOUNCES; bounce++) {
+		RayTriangleIntersection closest;
+		if(!closestIntersection(pairs, pOrigin, pDirection, 0.001f, closest)) return;
+		if(!pairs[closest.triangleIndex].second.mirror) {
+			if(bounce > 0) photons.push_back(PhotonRecord{closest.intersectionPoint, glm::vec3(flux), pDirection});
+			return;
+		}
+		glm::vec3 normal = closest.intersectedTriangle.normal;
+		pDirection = pDirection - 2.0f*normal*glm::dot(pDirection, normal);
+		pOrigin = closest.intersectionPoint;
+	}
+}
+
+//Split indices 0..amount-1 into one contiguous range per thread (up to photonThreads) and run body(begin, end, thread) on each
+template <typename Body>
+void parallelFor(int amount, Body body) {
+	int threadCount = glm::max(1, glm::min(photonThreads, amount));
+	std::vector<std::thread> workers;
+	for(int t = 0; t < threadCount; t++) {
+		int begin = (int)((long long)amount * t / threadCount);
+		int end = (int)((long long)amount * (t + 1) / threadCount);
+		workers.push_back(std::thread([&body, begin, end, t]() {
+			nameTraceThread("worker");
+			body(begin, end, t);
+		}));
+	}
+	for(int t = 0; t < threadCount; t++) workers[t].join();
+}
+
+//Run tracer(index, buffer) for indices 0..amount-1 across photonThreads threads.
+//Each thread takes a contiguous range of indices into its own buffer, reserved for recordsPerPhoton records each.
+template <typename Record, typename Tracer>
+std::vector<Record> traceInParallel(int amount, int recordsPerPhoton, Tracer tracer) {
+	int threadCount = glm::max(1, glm::min(photonThreads, amount));
+	std::vector<std::vector<Record>> buffers(threadCount);
+	parallelFor(amount, [&buffers, &tracer, recordsPerPhoton](int begin, int end, int t) {
+		TraceScope scope("photon batch");
+		buffers[t].reserve(recordsPerPhoton * (end - begin) + 64);
+		for(int p = begin; p < end; p++) tracer(p, buffers[t]);
+	});
+
+	//Concatenate in index order so the same seed gives the same map on any thread count
+	size_t total = 0;
+	for(int t = 0; t < threadCount; t++) total += buffers[t].size();
+	std::vector<Record> records;
+	records.reserve(total);
+	for(int t = 0; t < threadCount; t++) {
+		records.insert(records.end(), buffers[t].begin(), buffers[t].end());
+		std::vector<Record>().swap(buffers[t]);
+	}
+	return records;
+}
+
+//Normal of the triangle a surface point lies on, or zero if it isn't on any
+glm::vec3 surfaceNormalAt(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 point) {
+	for(int i = 0; i < pairs.size(); i++) {
+		glm::vec3 normal = pairs[i].first.normal;
+		glm::vec3 tuv = getPossibleIntersectionSolution(pairs[i].first, point + 0.001f * normal, -normal);
+		if(isValidIntersection(tuv) && tuv[0] < 0.002f) return normal;
+	}
+	return glm::vec3(0);
+}
+
+//Precompute the full photon estimate at every IRRADIANCE_STRIDE-th photon of the global map
+IrradianceCache irradianceCache(const std::vector<std::pair<ModelTriangle, Material>> &pairs, const PhotonMaps &maps) {
+	std::cout << "precomputing irradiance" << std::endl;
+	int amount = (int)(maps.global.size() / IRRADIANCE_STRIDE);
+	std::vector<IrradianceRecord> records = traceInParallel<IrradianceRecord>(amount, 1, [&pairs, &maps](int index, std::vector<IrradianceRecord> &buffer) {
+		if(photonQuit) return;
+		PhotonHit gathered[MAX_GATHER];
+		glm::vec3 loc = maps.global.position((size_t)index * IRRADIANCE_STRIDE);
+		glm::vec3 normal = surfaceNormalAt(pairs, loc);
+		//not counted in the profile, which is per frame drawn
+		if(normal != glm::vec3(0)) buffer.push_back(IrradianceRecord{loc, photonIntensity(maps, loc, gathered), normal});
+	});
+	std::cout << "irradiance cache built (" << records.size() << " records)" << std::endl;
+	return IrradianceCache(records);
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+	//FNV-1a
+	const unsigned char *bytes = (const unsigned char *)data;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+//Everything the photon map depends on, so a snapshot built for another scene or light is never reused
+uint64_t photonMapHash(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 light, int amount, bool caustic) {
+	uint64_t hash = 14695981039346656037ULL;
+	for(int i = 0; i < pairs.size(); i++) {
+		const ModelTriangle &triangle = pairs[i].first;
+		const Material &material = pairs[i].second;
+		hash = hashBytes(triangle.vertices.data(), sizeof(glm::vec3) * 3, hash);
+		hash = hashBytes(&triangle.normal, sizeof(glm::vec3), hash);
+		int colour[3] = {material.colour.red, material.colour.green, material.colour.blue};
+		hash = hashBytes(colour, sizeof(colour), hash);
+		hash = hashBytes(&material.mirror, sizeof(bool), hash);
+		hash = hashBytes(material.name.data(), material.name.size(), hash);
+	}
+	//the last entry changes whenever what a stored photon means changes
+	int settings[6] = {amount, MAX_BOUNCES, caustic, PROJECTION_RES, photonImportance, 4};
+	hash = hashBytes(&light, sizeof(glm::vec3), hash);
+	hash = hashBytes(settings, sizeof(settings), hash);
+	hash = hashBytes(&photonSeed, sizeof(photonSeed), hash);
+	return hash;
+}
+
+//One SPPM iteration: find visible points again if the camera moved (a tile at a time, nearest the focus first,
+//over slices of traceSliceMs), then trace a batch of photons in SPPM_BATCHES parts, fold them into every pixel's
+//statistics (shrinking its radius as photons accumulate), throw them away and show the estimate. Stops as soon
+//as input arrives, leaving the tiles dirty: an unfinished gather carries on from where it was next time, but
+//a half traced batch of photons is dropped rather than folded in.
+void sppmPass(DrawingWindow &window, const std::vector<std::pair<ModelTriangle, Material>> &pairs) {
+	TraceScope scope("sppm pass");
+	if(sppmTilesTraced < 0 || camera.pos != sppmCameraPos || camera.rot != sppmCameraRot) {
+		visiblePoints.assign(WIDTH * HEIGHT, VisiblePoint{glm::vec3(0), glm::vec3(0), false});
+		sppmPixels.assign(WIDTH * HEIGHT, SPPMPixel{SPPM_RADIUS * SPPM_RADIUS, 0.0f, 0.0f});
+		sppmPasses = 0;
+		sppmCameraPos = camera.pos;
+		sppmCameraRot = camera.rot;
+		//every tile is dirty in SPPM mode
+		sppmTileOrder = tiles.nearestFirst(traceFocusX, traceFocusY);
+		sppmTilesTraced = 0;
+	}
+	if(sppmTilesTraced < (int)sppmTileOrder.size()) {
+		std::vector<PhotonHit> gathered(MAX_GATHER);
+		std::shared_ptr<const PhotonMaps> maps = std::atomic_load(&photonMaps);
+		std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now() + std::chrono::milliseconds(traceSliceMs);
+		while(sppmTilesTraced < (int)sppmTileOrder.size()) {
+			if(renderInterrupted() || std::chrono::steady_clock::now() >= stop) return;
+			traceVisibleTile(window, pairs, maps.get(), sppmTileOrder[sppmTilesTraced], gathered.data());
+			sppmTilesTraced++;
+		}
+	}
+
+	uint64_t firstPhoton = (uint64_t)sppmPasses * SPPM_PHOTONS;
+	PhotonEmitter emitter = photonEmitter(pairs, lightSource);
+	std::vector<PhotonRecord> photons;
+	for(int batch = 0; batch < SPPM_BATCHES; batch++) {
+		if(renderInterrupted()) return;
+		int begin = (int)((long long)SPPM_PHOTONS * batch / SPPM_BATCHES);
+		int end = (int)((long long)SPPM_PHOTONS * (batch + 1) / SPPM_BATCHES);
+		std::vector<PhotonRecord> traced = traceInParallel<PhotonRecord>(end - begin, 2, [&pairs, &emitter, firstPhoton, begin](int index, std::vector<PhotonRecord> &buffer) {
+			tracePhoton(pairs, emitter, firstPhoton + begin + index, buffer);
+		});
+		photons.insert(photons.end(), traced.begin(), traced.end());
+	}
+	if(renderInterrupted()) return;
+	//radii only ever shrink, so cells of the starting radius keep every query within 3 cells per axis
+	PhotonGrid grid(photons, SPPM_RADIUS);
+	std::vector<PhotonRecord>().swap(photons);
+	sppmPasses++;
+
+	parallelFor(WIDTH * HEIGHT, [&grid](int begin, int end, int) {
+		ScopedTimer timer(profile, STAGE_GATHER);
+		TraceScope scope("sppm gather");
+		PhotonHit gathered[MAX_GATHER];
+		uint64_t photonsGathered = 0;
+		for(int i = begin; i < end; i++) {
+			if(!visiblePoints[i].valid) continue;
+			SPPMPixel &pixel = sppmPixels[i];
+			int found = grid.radiusSearch(visiblePoints[i].loc, glm::sqrt(pixel.radius2), gathered, MAX_GATHER);
+			photonsGathered += found;
+			if(found == 0) continue;
+			float flux = 0;
+			for(int p = 0; p < found; p++) flux += gathered[p].intensity;
+			//keep only a fraction alpha of the new photons and shrink the radius to match
+			float photonCount = pixel.photons + SPPM_ALPHA * found;
+			float shrink = photonCount / (pixel.photons + found);
+			pixel.flux = (pixel.flux + flux) * shrink;
+			pixel.radius2 *= shrink;
+			pixel.photons = photonCount;
+		}
+		profile.count(COUNT_PHOTONS, photonsGathered);
+	});
+
+	//photons confined to the emission cone stand in for a whole sphere's worth
+	float emitted = (float)sppmPasses * SPPM_PHOTONS / emitter.fraction;
+	for(int v = 0; v < HEIGHT; v++) {
+		for(int u = 0; u < WIDTH; u++) {
+			int i = v * WIDTH + u;
+			glm::vec3 colour(0);
+			if(visiblePoints[i].valid) {
+				float radiance = sppmPixels[i].flux / (M_PI * sppmPixels[i].radius2 * emitted);
+				colour = glm::clamp(SPPM_EXPOSURE * radiance * visiblePoints[i].colour, 0.0f, 255.0f);
 			}
+			window.setPixelColour(u, v, colourPack(Colour(colour.r, colour.g, colour.b), 0xFF));
+		}
+	}
+	tiles.finishRedraw();
+}
+
+//The photons held by a tree, to rebuild them into another lookup structure
+std::vector<PhotonRecord> photonRecords(const KDTree &tree) {
+	std::vector<PhotonRecord> photons(tree.size());
+	for(size_t i = 0; i < tree.size(); i++) photons[i] = PhotonRecord{tree.position(i), tree.power(i), tree.direction(i)};
+	return photons;
+}
+
+//Fill in what gets gathered from, and the irradiance cache if it's wanted, before publishing a set of maps
+void finishPhotonMaps(const std::vector<std::pair<ModelTriangle, Material>> &pairs, PhotonMaps &maps) {
+	maps.globalPhotons = &maps.global;
+	maps.causticPhotons = &maps.caustic;
+	if(photonGrid) {
+		maps.globalGrid = PhotonGrid(photonRecords(maps.global), PHOTON_RADIUS);
+		maps.causticGrid = PhotonGrid(photonRecords(maps.caustic), CAUSTIC_RADIUS);
+		maps.globalPhotons = &maps.globalGrid;
+		maps.causticPhotons = &maps.causticGrid;
+	}
+	if(irradianceMode) {
+		maps.irradiance = irradianceCache(pairs, maps);
+		maps.irradianceExists = true;
+	}
+}
+
+//False once the maps being built for version are no longer wanted: the light has moved again, or we're exiting
+bool photonBuildCurrent(int version) {
+	return photonVersion == version && !photonQuit;
+}
+
+//Build the photon maps for a light at `light`. A snapshot for the same scene is mapped straight in; otherwise photons
+//are traced in stages of PROGRESSIVE_FIRST, then 4x as many each time, and the maps so far are published after
+//every stage. Photon indices continue from stage to stage, so the final maps match a one-shot build, and those get
+//snapshotted. Gives up as soon as the light moves again or the program exits.
+void buildPhotonMaps(const std::vector<std::pair<ModelTriangle, Material>> &pairs, glm::vec3 light, int version) {
+	TraceScope scope("photon maps");
+	uint64_t globalHash = photonMapHash(pairs, light, PHOTON_COUNT, false);
+	uint64_t causticHash = photonMapHash(pairs, light, CAUSTIC_COUNT, true);
+	std::shared_ptr<PhotonMaps> maps(new PhotonMaps());
+	if(maps->global.load(PHOTON_SNAPSHOT, globalHash) && maps->caustic.load(CAUSTIC_SNAPSHOT, causticHash)) {
+		std::cout << "photon maps loaded from " << PHOTON_SNAPSHOT << " and " << CAUSTIC_SNAPSHOT << std::endl;
+		maps->causticEmitted = CAUSTIC_COUNT;
+		finishPhotonMaps(pairs, *maps);
+		if(photonBuildCurrent(version)) {
+			std::atomic_store(&photonMaps, std::shared_ptr<const PhotonMaps>(maps));
+			photonMapsPublished++;
 		}
+		return;
 	}
 
-	KDTree photonTree(photons[0]);
-	if(!photons.empty()) {
-		for(int p = 1; p < photons.size(); p++) {
-			photonTree.insert(photonTree.root, photons[p], 0);
-			// std::cout << p << " " << n->value[2] << std::endl;
+	std::cout << "building photon maps" << std::endl;
+	std::vector<int> cells = projectionMap(pairs, light);
+	PhotonEmitter emitter = photonEmitter(pairs, light);
+	std::vector<PhotonRecord> photons;
+	std::vector<PhotonRecord> caustics;
+	int traced = 0;
+	int causticTraced = 0;
+	for(int stage = PROGRESSIVE_FIRST; traced < PHOTON_COUNT; stage *= 4) {
+		int target = glm::min(stage, PHOTON_COUNT);
+		int causticTarget = (int)((long long)CAUSTIC_COUNT * target / PHOTON_COUNT);
+		//half the photons survive each bounce, so ~2 records per photon
+		std::vector<PhotonRecord> batch = traceInParallel<PhotonRecord>(target - traced, 2, [&pairs, &emitter, traced, version](int index, std::vector<PhotonRecord> &buffer) {
+			if(photonBuildCurrent(version)) tracePhoton(pairs, emitter, traced + index, buffer);
+		});
+		photons.insert(photons.end(), batch.begin(), batch.end());
+		if(!cells.empty()) {
+			batch = traceInParallel<PhotonRecord>(causticTarget - causticTraced, 1, [&pairs, &cells, light, causticTraced, version](int index, std::vector<PhotonRecord> &buffer) {
+				if(photonBuildCurrent(version)) traceCausticPhoton(pairs, light, cells, causticTraced + index, buffer);
+			});
+			caustics.insert(caustics.end(), batch.begin(), batch.end());
 		}
+		if(!photonBuildCurrent(version)) return;
+		traced = target;
+		causticTraced = causticTarget;
+
+		maps = std::shared_ptr<PhotonMaps>(new PhotonMaps());
+		maps->global = KDTree(photons);
+		maps->caustic = KDTree(caustics);
+		maps->causticEmitted = causticTraced;
+		finishPhotonMaps(pairs, *maps);
+		if(!photonBuildCurrent(version)) return;
+		std::atomic_store(&photonMaps, std::shared_ptr<const PhotonMaps>(maps));
+		photonMapsPublished++;
+		std::cout << "photon maps: " << traced << "/" << PHOTON_COUNT << " emitted (" << photons.size() << " photons, " << caustics.size() << " caustic photons)" << std::endl;
 	}
-	photonsExist = true;
-	std::cout << "photon map built" << std::endl;
-	return photonTree;
+	if(!maps->global.save(PHOTON_SNAPSHOT, globalHash)) std::cout << "could not write " << PHOTON_SNAPSHOT << std::endl;
+	if(!maps->caustic.save(CAUSTIC_SNAPSHOT, causticHash)) std::cout << "could not write " << CAUSTIC_SNAPSHOT << std::endl;
 }
 
-void draw(DrawingWindow &window) {
-	for(int x = 0; x < WIDTH; x++) {
-		for(int y = 0; y < HEIGHT; y++) {
-			ZBuffer[x][y] = 0.0;
+//Runs until stopPhotonBuilder(), rebuilding the photon maps whenever photonVersion moves on. Builds from its
+//own copy of the scene, taken under photonMutex, so the render thread can recolour pairs meanwhile.
+void photonBuilder(const std::vector<std::pair<ModelTriangle, Material>> &pairs) {
+	nameTraceThread("photon builder");
+	int built = -1;
+	std::vector<std::pair<ModelTriangle, Material>> scene;
+	while(true) {
+		glm::vec3 light;
+		int version;
+		{
+			std::unique_lock<std::mutex> lock(photonMutex);
+			photonWake.wait(lock, [built]() { return photonVersion != built || photonQuit; });
+			if(photonQuit) return;
+			version = photonVersion;
+			light = lightSource;
+			scene = pairs;
 		}
+		buildPhotonMaps(scene, light, version);
+		built = version;
 	}
-	window.clearPixels();
-	switch (renderMode)
+}
+
+void startPhotonBuilder(const std::vector<std::pair<ModelTriangle, Material>> &pairs) {
+	if(photonThread.joinable()) return;
+	photonThread = std::thread(photonBuilder, std::cref(pairs));
+}
+
+//Abandon any build in progress and wait for the builder to return, before the globals it reads are destroyed
+void stopPhotonBuilder() {
 	{
-	case WIREFRAME:
+		std::lock_guard<std::mutex> lock(photonMutex);
+		photonQuit = true;
+	}
+	photonWake.notify_one();
+	if(photonThread.joinable()) photonThread.join();
+}
+
+//Ask the builder for fresh photon maps; frames keep using the current ones until the first stage is ready
+void invalidatePhotonMaps() {
+	std::lock_guard<std::mutex> lock(photonMutex);
+	photonVersion++;
+	photonWake.notify_one();
+}
+
+void moveLight(glm::vec3 offset) {
+	{
+		std::lock_guard<std::mutex> lock(photonMutex);
+		lightSource += offset;
+		photonVersion++;
+	}
+	photonWake.notify_one();
+	restartSPPM();
+	lightVersion++;
+}
+
+//The wireframe or filled triangles, projected at 1/drawScale resolution
+void rasterise(DrawingWindow &window) {
+	TraceScope scope("rasterise");
+	if(renderMode == RASTERIZING) {
 		for(int i=0; i < pairs.size(); i++) {
-			ModelTriangle triangle = pairs[i].first;
-			Material material = pairs[i].second;
-
-			std::vector<glm::vec3> renderPos;
-			for(int i=0; i < triangle.vertices.size(); i++) {
-				glm::vec3 vertex = triangle.vertices[i] - camera.pos;
-				vertex = camera.rot * vertex;
-				float u = glm::floor(-1*camera.f*(vertex.x / vertex.z)*(HEIGHT*1.5)+ WIDTH/2);
-				float v = glm::floor(camera.f*(vertex.y / vertex.z)*(HEIGHT*1.5) + HEIGHT/2);
-				float Z = INFINITY;
-				
-				if(vertex.z != 0.0) {
-					Z = glm::abs(1 / vertex.z);
-				}
-				renderPos.push_back(glm::vec3(u, v, Z));
+			drawModelTriangle(window, pairs[i], i);
+		}
+		return;
+	}
+	for(int i=0; i < pairs.size(); i++) {
+		ModelTriangle triangle = pairs[i].first;
+		Material material = pairs[i].second;
+
+		std::vector<glm::vec3> renderPos;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for(int i=0; i < triangle.vertices.size(); i++) {
+			glm::vec3 vertex = triangle.vertices[i] - camera.pos;
+			vertex = camera.rot * vertex;
+			float u = glm::floor((-1*camera.f*(vertex.x / vertex.z)*(HEIGHT*1.5)+ WIDTH/2) / drawScale);
+			float v = glm::floor((camera.f*(vertex.y / vertex.z)*(HEIGHT*1.5) + HEIGHT/2) / drawScale);
+			float Z = INFINITY;
+			
+			if(vertex.z != 0.0) {
+				Z = glm::abs(1 / vertex.z);
 			}
-			CanvasTriangle transposedTri = CanvasTriangle(CanvasPoint(renderPos[0].x, renderPos[0].y, renderPos[0].z), CanvasPoint(renderPos[1].x, renderPos[1].y, renderPos[1].z) ,CanvasPoint(renderPos[2].x, renderPos[2].y, renderPos[2].z));
-			drawTriangle(window,transposedTri,material.colour);
+			renderPos.push_back(glm::vec3(u, v, Z));
 		}
-		break;
-	case RASTERIZING:
-		for(int i=0; i < pairs.size(); i++) {
-			drawModelTriangle(window, pairs[i]);
+		profile.add(STAGE_TRANSFORM, std::chrono::steady_clock::now() - start);
+		CanvasTriangle transposedTri = CanvasTriangle(CanvasPoint(renderPos[0].x, renderPos[0].y, renderPos[0].z), CanvasPoint(renderPos[1].x, renderPos[1].y, renderPos[1].z) ,CanvasPoint(renderPos[2].x, renderPos[2].y, renderPos[2].z));
+		if(!dependOnTriangle(transposedTri, i)) continue;
+		ScopedTimer timer(profile, STAGE_RASTER);
+		profile.count(COUNT_TRIANGLES, 1);
+		drawTriangle(window,transposedTri,material.colour);
+	}
+}
+
+//Rasterise the whole frame scale times smaller and stretch it over the window. Every tile is left dirty for the
+//full resolution frame. Returns how long the drawing took in ms, not counting the stretch.
+double drawScaled(DrawingWindow &window, int scale) {
+	TraceScope scope("scaled frame");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int w = (WIDTH + scale - 1) / scale;
+	int h = (HEIGHT + scale - 1) / scale;
+	std::vector<uint32_t> small(w * h);
+	tiles.markAll();
+	//drawn into the top left corner of the back buffer, which the stretched frame then covers
+	std::chrono::steady_clock::time_point clear = std::chrono::steady_clock::now();
+	for(int x = 0; x < w; x++) {
+		for(int y = 0; y < h; y++) {
+			ZBuffer[x][y] = 0.0;
+			window.setPixelColour(x, y, 0);
 		}
-		break;
-	case RAYTRACING:
-		if(!photonsExist) PHOTONMAP = photonMap(pairs, 1000000);
-		rayTracing(window, pairs, 750.0);
+	}
+	profile.add(STAGE_CLEAR, std::chrono::steady_clock::now() - clear);
+	drawScale = scale;
+	rasterise(window);
+	drawScale = 1;
+	for(int x = 0; x < w; x++) {
+		for(int y = 0; y < h; y++) small[y * w + x] = window.getPixelColour(x, y);
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::vector<uint32_t> full(WIDTH * HEIGHT);
+	upscaleBilinear(small.data(), w, h, full.data(), WIDTH, HEIGHT);
+	for(int x = 0; x < WIDTH; x++) {
+		for(int y = 0; y < HEIGHT; y++) window.setPixelColour(x, y, full[y * WIDTH + x]);
+	}
+	return ms;
+}
+
+//Redraw the dirty tiles
+void drawDirtyTiles(DrawingWindow &window) {
+	//the ray tracer is too slow to redraw everything in one go: it goes a slice at a time, clearing each tile only
+	//as it reaches it, so the rest of the previous frame stays up meanwhile
+	if(renderMode == RAYTRACING) {
+		startPhotonBuilder(pairs);
+		traceTiles(window, pairs, traceSliceMs);
+		return;
+	}
+	//SPPM redraws every pixel each pass and keeps the last one up until the next is done
+	if(renderMode == SPPM) {
+		sppmPass(window, pairs);
+		return;
+	}
+	tiles.beginRedraw();
+	std::chrono::steady_clock::time_point clear = std::chrono::steady_clock::now();
+	traceBegin("clear");
+	for(int t = 0; t < tiles.columns * tiles.rows; t++) {
+		if(!tiles.isDirty(t)) continue;
+		int x0, y0, x1, y1;
+		tiles.bounds(t, x0, y0, x1, y1);
+		for(int x = x0; x < x1; x++) {
+			for(int y = y0; y < y1; y++) {
+				ZBuffer[x][y] = 0.0;
+				window.setPixelColour(x, y, 0);
+			}
+		}
+	}
+	traceEnd("clear");
+	profile.add(STAGE_CLEAR, std::chrono::steady_clock::now() - clear);
+	switch (renderMode)
+	{
+	case WIREFRAME:
+	case RASTERIZING:
+		rasterise(window);
 		break;
 	default:
 		break;
 	}
-	window.setPixelColour(432,39,0x00FF0000);
-	
+	tiles.finishRedraw();
+}
+
+//Sleep until the camera has been still for CAMERA_SETTLE_MS, unless input comes first
+void waitForSettle(std::chrono::steady_clock::time_point settled) {
+	std::unique_lock<std::mutex> lock(inputMutex);
+	inputWake.wait_until(lock, settled, []() { return renderInterrupted(); });
+}
+
+//False if nothing was drawn: the camera is still moving and its latest position has been drawn scaled already
+bool draw(DrawingWindow &window) {
+	if(frameTargetMs <= 0 || renderMode == SPPM) {
+		drawDirtyTiles(window);
+		return true;
+	}
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if(cameraVersion != seenCamera) {
+		seenCamera = cameraVersion;
+		cameraMoved = now;
+		refineMs = 0;
+		refineWhole = true;
+	}
+	//aim for frameTargetMs, going by pixel count
+	double &estimate = fullFrameMs[renderMode];
+	int scale = estimate < 0 ? MAX_RENDER_SCALE : glm::clamp((int)glm::ceil(glm::sqrt(estimate / frameTargetMs)), 1, MAX_RENDER_SCALE);
+	std::chrono::steady_clock::time_point settled = cameraMoved + std::chrono::milliseconds(CAMERA_SETTLE_MS);
+	if(scale > 1 && now < settled && renderMode == RAYTRACING) {
+		//the passes work in powers of two
+		int block = 1;
+		while(block < scale) block *= 2;
+		if(tilesRefinedTo(block)) {
+			waitForSettle(settled);
+			return false;
+		}
+		startPhotonBuilder(pairs);
+		traceTiles(window, pairs, traceSliceMs, block);
+		refineMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - now).count();
+		//the passes down to block x block trace one pixel in block * block
+		if(refineWhole && tilesRefinedTo(block)) estimate = estimate < 0 ? refineMs * block * block : 0.5 * (estimate + refineMs * block * block);
+		return true;
+	}
+	if(scale > 1 && now < settled) {
+		if(cameraVersion == scaledCamera) {
+			waitForSettle(settled);
+			return false;
+		}
+		scaledCamera = cameraVersion;
+		double ms = drawScaled(window, scale) * scale * scale;
+		estimate = estimate < 0 ? ms : 0.5 * (estimate + ms);
+		return true;
+	}
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	drawDirtyTiles(window);
+	if(!refineWhole) return true;
+	refineMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	//the ray tracer takes many slices to finish the frame
+	if(tiles.any()) return true;
+	refineWhole = false;
+	estimate = estimate < 0 ? refineMs : 0.5 * (estimate + refineMs);
+	return true;
 }
 float theta = glm::acos(camera.pos.x / glm::distance(glm::vec3(0.0), camera.pos));
 
@@ -1003,6 +1885,7 @@ void orbit() {
 	float newZ = radius*glm::sin(theta);
 	camera.pos = glm::vec3(newX, camera.pos.y, newZ);
 	camera.rot = lookAt();
+	cameraVersion++;
 }
 
 void update(DrawingWindow &window) {
@@ -1010,10 +1893,217 @@ void update(DrawingWindow &window) {
 
 }
 
+//What a drawn frame depends on besides individual triangles (which mark their own tiles when they change)
+struct FrameState {
+	int camera;
+	int light;
+	int scene;
+	int photons;
+};
+
+FrameState currentFrameState() {
+	//only the ray tracer's photon view draws from the photon maps
+	int photons = renderMode == RAYTRACING && photonmode ? photonMapsPublished.load() : 0;
+	return FrameState{cameraVersion, lightVersion, sceneVersion, photons};
+}
+
+//Mark the tiles that changes since `seen` affect, and bring `seen` up to date. True if any tile needs drawing.
+bool invalidateTiles(FrameState &seen) {
+	FrameState now = currentFrameState();
+	//every SPPM pass refines the whole image further
+	if(renderMode == SPPM || now.camera != seen.camera || now.scene != seen.scene || now.photons != seen.photons) tiles.markAll();
+	//the rasterizer and the photon view don't light anything directly
+	else if(now.light != seen.light && renderMode == RAYTRACING && !photonmode) tiles.markLit();
+	seen = now;
+	return tiles.any();
+}
+
+
+
+//SDL thread: hand an event to the render thread, dropping it if the render thread is that far behind
+void sendInput(const SDL_Event &event) {
+	InputEvent input;
+	input.event = event;
+	SDL_GetMouseState(&input.mouseX, &input.mouseY);
+	if(!inputQueue.push(input)) return;
+	//under the lock so the wake can't fall between the render thread checking the queue and going to sleep
+	std::lock_guard<std::mutex> lock(inputMutex);
+	inputWake.notify_one();
+}
+
+#define HUD_SCALE 2
+//Swap with the profile drawn over the top left corner of the front buffer only, so it never gets into saved
+//frames or under the tiles the next frame keeps
+void swapWithHud(DrawingWindow &window, const FrameTimes &times) {
+	std::vector<std::string> lines;
+	for(int s = 0; s < STAGE_COUNT; s++) {
+		std::ostringstream line;
+		line << FrameProfile::stageName((ProfileStage)s) << " " << std::fixed << std::setprecision(2) << times.ms[s];
+		lines.push_back(line.str());
+	}
+	for(int c = 0; c < COUNTER_COUNT; c++) lines.push_back(std::string(FrameProfile::counterName((ProfileCounter)c)) + " " + std::to_string(times.counts[c]));
+	int lineHeight = 7 * HUD_SCALE;
+	int width = glm::min(WIDTH, 24 * textAdvance(HUD_SCALE));
+	int height = glm::min(HEIGHT, (int)lines.size() * lineHeight + 2 * HUD_SCALE);
+	std::vector<uint32_t> under(width * height);
+	for(int x = 0; x < width; x++) {
+		for(int y = 0; y < height; y++) {
+			uint32_t pixel = window.getPixelColour(x, y);
+			under[y * width + x] = pixel;
+			//darkened to half so the text stands out
+			window.setPixelColour(x, y, (pixel & 0xFF000000) | ((pixel >> 1) & 0x007F7F7F));
+		}
+	}
+	for(size_t i = 0; i < lines.size(); i++) drawText(window, 2 * HUD_SCALE, 2 * HUD_SCALE + (int)i * lineHeight, lines[i], 0xFFFFFF00, HUD_SCALE);
+	window.swapBuffers();
+	for(int x = 0; x < width; x++) {
+		for(int y = 0; y < height; y++) window.setPixelColour(x, y, under[y * width + x]);
+	}
+}
+
+//Everything but SDL runs here: handling input, drawing and saving frames. A frame that takes minutes only
+//delays the next swap; the window keeps presenting the last finished one.
+void renderLoop(DrawingWindow &window, std::string frameFormat) {
+	nameTraceThread("render");
+	int n = 0;
+	//taken before drawing, so photon maps published mid-frame still count as new next time round
+	FrameState seen = {-1, -1, -1, -1};
+	int swapped = -1;
+	int swaps = 0;
+	bool hudShown = false;
+	double savedSeconds = 0;
+	while (!renderQuit) {
+		//with nothing moving, sleep until there's input (waking now and then for new photon maps)
+		if (!orbitMode && !invalidateTiles(seen)) {
+			std::unique_lock<std::mutex> lock(inputMutex);
+			inputWake.wait_for(lock, std::chrono::milliseconds(IDLE_WAIT_MS), []() { return !inputQueue.empty() || renderQuit; });
+		}
+		InputEvent input;
+		while (inputQueue.pop(input)) {
+			TraceScope scope("input");
+			if (traceFromMouse) {
+				traceFocusX = input.mouseX;
+				traceFocusY = input.mouseY;
+			}
+			handleEvent(input, window);
+		}
+		update(window);
+		if (invalidateTiles(seen)) {
+			TraceScope scope("draw");
+			if (draw(window)) pixelsVersion++;
+		}
+
+		//identical frames are neither swapped nor saved again, and partly traced ones are shown but not saved
+		if (pixelsVersion == swapped && hudMode == hudShown) continue;
+		TraceScope scope("swap");
+		bool complete = !tiles.any();
+		if (pixelsVersion != swapped && complete) {
+			frameWriter->submit(window.getPixelBuffer(), "frames/output" + std::to_string(n) + "." + frameFormat);
+			n++;
+		}
+		//the writer's own count of time spent encoding, however many threads it took
+		double seconds = frameWriter->stats().seconds;
+		profile.add(STAGE_SAVE, std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds - savedSeconds)));
+		savedSeconds = seconds;
+		FrameTimes times = profile.collect();
+		if (profileLog.is_open()) profileLog << profileJson(swaps, complete, times) << std::endl;
+		swaps++;
+		if (hudMode) swapWithHud(window, times);
+		else window.swapBuffers();
+		swapped = pixelsVersion;
+		hudShown = hudMode;
+	}
+}
 
+//Registered before stopRenderThread(), so it runs after it at exit
+void writeTraceFile() {
+	//so the last frames' writes are in the trace
+	if(frameWriter) frameWriter->flush();
+	if(writeTrace(traceFile)) std::cout << "trace events written to " << traceFile << std::endl;
+	else std::cout << "could not write " << traceFile << std::endl;
+}
+
+//Run at exit (quitting happens inside DrawingWindow::pollForInputEvents), so the render thread finishes its
+//frame and stops before the globals it uses are destroyed. The photon builder goes after it, since only the
+//render thread starts it.
+void stopRenderThread() {
+	{
+		std::lock_guard<std::mutex> lock(inputMutex);
+		renderQuit = true;
+	}
+	inputWake.notify_one();
+	if(renderThread.joinable()) renderThread.join();
+	stopPhotonBuilder();
+}
 
 int main(int argc, char *argv[]) {
 	srand(time(NULL));
+	std::vector<std::string> sceneFiles = {"textured-cornell-box.obj", "logo2.obj", "sphere.obj"};
+	float sceneScale = 0.17;
+	bool compileScene = false;
+	int frameQueue = 4;
+	bool dropFrames = false;
+	std::string frameFormat = "ppm";
+	int frameWorkers = glm::max(1, (int)std::thread::hardware_concurrency() / 2);
+	bool frameStats = false;
+	std::string videoPath;
+	int videoFps = 30;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--seed" && i + 1 < argc) photonSeed = std::stoull(argv[++i]);
+		else if(arg == "--threads" && i + 1 < argc) photonThreads = glm::max(1, std::stoi(argv[++i]));
+		else if(arg == "--photon-grid") photonGrid = true;
+		else if(arg == "--photon-importance") photonImportance = true;
+		else if(arg == "--compile-scene") compileScene = true;
+		else if(arg == "--frame-queue" && i + 1 < argc) frameQueue = glm::max(1, std::stoi(argv[++i]));
+		else if(arg == "--drop-frames") dropFrames = true;
+		else if(arg == "--frame-format" && i + 1 < argc) frameFormat = argv[++i];
+		else if(arg == "--frame-workers" && i + 1 < argc) frameWorkers = glm::max(1, std::stoi(argv[++i]));
+		else if(arg == "--frame-stats") frameStats = true;
+		else if(arg == "--video" && i + 1 < argc) videoPath = argv[++i];
+		else if(arg == "--fps" && i + 1 < argc) videoFps = glm::max(1, std::stoi(argv[++i]));
+		else if(arg == "--trace-slice" && i + 1 < argc) traceSliceMs = glm::max(1, std::stoi(argv[++i]));
+		else if(arg == "--trace-from-mouse") traceFromMouse = true;
+		else if(arg == "--frame-target" && i + 1 < argc) frameTargetMs = glm::max(0.0, std::stod(argv[++i]));
+		else if(arg == "--hud") hudMode = true;
+		else if(arg == "--profile-log" && i + 1 < argc) {
+			profileLog.open(argv[++i]);
+			if(!profileLog) std::cout << "could not open " << argv[i] << std::endl;
+		}
+		else if(arg == "--trace-events" && i + 1 < argc) traceFile = argv[++i];
+	}
+	if(!traceFile.empty()) {
+		startTracing();
+		nameTraceThread("main");
+		std::atexit(writeTraceFile);
+	}
+	//compile the scene ahead of time and stop
+	if(compileScene) {
+		bool compiled = SceneFile::compile(SCENE_CACHE, sceneFiles, sceneScale, photonThreads);
+		std::cout << (compiled ? "compiled " : "could not compile ") << SCENE_CACHE << std::endl;
+		return compiled ? 0 : 1;
+	}
+	//--video streams every frame into one Y4M file (or bare RGB frames for .rgb/.raw, or stdout for -) instead
+	//of writing frames/outputN.ppm. Opened before anything else is printed so stdout can be taken over.
+	//Otherwise --frame-format picks ppm, qoi (fast, lossless) or png (slower, opens anywhere)
+	std::unique_ptr<FrameSink> frameSink;
+	if(frameFormat == "qoi") frameSink.reset(new QOISink());
+	else if(frameFormat == "png") frameSink.reset(new PNGSink());
+	else {
+		frameFormat = "ppm";
+		frameSink.reset(new PPMSink());
+	}
+	if(!videoPath.empty()) {
+		bool raw = videoPath.size() > 4 && (videoPath.substr(videoPath.size() - 4) == ".rgb" || videoPath.substr(videoPath.size() - 4) == ".raw");
+		VideoSink *video = new VideoSink(videoPath, raw ? RAW_RGB : Y4M, videoFps);
+		frameSink.reset(video);
+		if(!video->isOpen()) {
+			std::cerr << "could not open " << videoPath << std::endl;
+			return 1;
+		}
+	}
+	frameWriter.reset(new FrameWriter(WIDTH, HEIGHT, frameQueue, dropFrames, std::move(frameSink), frameWorkers));
+	frameWriter->setVerbose(frameStats);
 	ZBuffer.resize(WIDTH);
 	for(int x = 0; x < WIDTH; x++) {
 		ZBuffer[x].resize(HEIGHT);
@@ -1022,27 +2112,32 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	pairs = loadObj("textured-cornell-box.obj", 0.17);
-	std::vector<std::pair<ModelTriangle, Material>> logo = loadObj("logo2.obj", 0.17);
-	for(int i = 0; i < logo.size(); i++) {
-		pairs.push_back(logo[i]);
-	}
-	std::vector<std::pair<ModelTriangle, Material>> orb = loadObj("sphere.obj", 0.17);
-	for(int i = 0; i < orb.size(); i++) {
-		pairs.push_back(orb[i]);
-	}
+	pairs = loadScene(sceneFiles, sceneScale);
 	lightSource = glm::vec3(0, pairs[0].first.vertices[2].y - 0.1, 0.0); 
 
-	DrawingWindow window = DrawingWindow(WIDTH, HEIGHT, false);
+	DrawingWindow window(WIDTH, HEIGHT, false);
+	renderThread = std::thread(renderLoop, std::ref(window), frameFormat);
+	std::atexit(stopRenderThread);
+
 	SDL_Event event;
-	int n = 0;
+	//uncovered or resized: present again even without a new frame
+	bool damaged = false;
+	std::chrono::steady_clock::time_point nextPresent = std::chrono::steady_clock::now();
 	while (true) {
-		if (window.pollForInputEvents(event)) handleEvent(event, window);
-		update(window);
-		draw(window);
-
-		window.renderFrame();
-		window.savePPM("frames/output" + std::to_string(n) + ".ppm");
-		n++;
+		//forward input as soon as it arrives, and present new frames at PRESENT_HZ
+		int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(nextPresent - std::chrono::steady_clock::now()).count();
+		if (window.waitForInputEvents(event, glm::max(wait, 0))) {
+			if (event.type == SDL_WINDOWEVENT) damaged = true;
+			else sendInput(event);
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now >= nextPresent) {
+			TraceScope scope("present");
+			if (window.presentFrame(damaged)) profile.add(STAGE_PRESENT, std::chrono::steady_clock::now() - now);
+			damaged = false;
+			nextPresent += std::chrono::microseconds(1000000 / PRESENT_HZ);
+			//don't try to catch up after a stall
+			if (nextPresent < now) nextPresent = now;
+		}
 	}
 }